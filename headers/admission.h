@@ -0,0 +1,68 @@
+/*
+ * Asynchronous Web Server - admission control
+ *
+ * Past --max-connections open connections, --max-aio-bytes of disk reads
+ * in flight or --max-open-files files being served, the server stops
+ * taking connections. With --overload=pause (the default) listenfd leaves
+ * the epoll set and new clients wait in the kernel's accept queue; with
+ * --overload=503 each one is accepted, answered with a canned 503 and
+ * closed. Accepting resumes once every figure is back under 7/8 of its
+ * limit, so the listener does not flap at the edge.
+ *
+ * Running out of descriptors in accept() counts as reaching the
+ * connection limit, at the number of connections open at the time.
+ *
+ * With --codel, the time each connection waited between accept() and
+ * the dispatch of its first request is its sojourn. Once sojourns have
+ * stayed above the target for a whole interval, the loop is behind on
+ * work it already took: new connections are answered 503 at once, at
+ * CoDel's rising rate, until one gets through under the target again.
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum admission_limit {
+	LIMIT_CONNECTIONS,
+	LIMIT_AIO_BYTES,
+	LIMIT_OPEN_FILES,
+	ADMISSION_LIMITS
+};
+
+/* What the server holds right now */
+struct admission_load {
+	int connections;
+	int open_files;
+	size_t aio_bytes;
+};
+
+/* Non-zero while new connections are to be held off */
+int admission_overloaded(const struct admission_load *load);
+
+/* accept() ran out of descriptors with this many connections open */
+void admission_fd_exhausted(int connections);
+
+/* a connection was turned away with 503 */
+void admission_rejected(void);
+
+/*
+ * A first request is dispatched at now, sojourn ns after its connection
+ * was accepted. Non-zero if it is to be shed.
+ */
+int admission_codel(uint64_t sojourn, uint64_t now);
+
+void admission_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADMISSION_H_ */
@@ -0,0 +1,35 @@
+/*
+ * Asynchronous Web Server - request phases for heap call accounting
+ *
+ * The main loop records which phase of a request it is in. The aws-alloc
+ * build (tests/bench/alloc_count.c) charges every heap call to the
+ * current phase; in the regular build this is a plain store.
+ */
+
+#ifndef ALLOC_PHASE_H_
+#define ALLOC_PHASE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum alloc_phase {
+	ALLOC_OTHER,
+	ALLOC_ACCEPT,
+	ALLOC_RECEIVE,
+	ALLOC_PARSE,
+	ALLOC_OPEN,
+	ALLOC_SEND,
+	ALLOC_PHASES
+};
+
+/* defined in server.c */
+extern enum alloc_phase alloc_phase;
+
+#define ALLOC_PHASE(p)	(alloc_phase = (p))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOC_PHASE_H_ */
@@ -0,0 +1,33 @@
+/*
+ * Asynchronous Web Server - per-request bump arena
+ *
+ * Objects that live exactly as long as one response are bumped out of
+ * blocks borrowed from the I/O buffer pool and all handed back at once
+ * when the response ends. There is no per-object free.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+struct arena {
+	/* current block, its header links the older ones */
+	char *block;
+	size_t size;
+	size_t used;
+};
+
+/* NULL only when the buffer pool can not grow */
+void *arena_alloc(struct arena *a, size_t size);
+void arena_release(struct arena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARENA_H_ */
@@ -18,6 +18,117 @@ extern "C" {
 #define AWS_ABS_STATIC_FOLDER		AWS_DOCUMENT_ROOT AWS_REL_STATIC_FOLDER
 #define AWS_ABS_DYNAMIC_FOLDER		AWS_DOCUMENT_ROOT AWS_REL_DYNAMIC_FOLDER
 
+/* accept queue length, bursts of clients must not hit SYN retries */
+#define AWS_LISTEN_BACKLOG		4096
+
+#define AWS_CACHE_LINE			64
+
+/* I/O buffer size classes run from AWS_IOBUF_MIN up to 256 times that */
+#define AWS_IOBUF_MIN			(4 * 1024)
+/* buffers are carved from mappings of this size, one huge page */
+#define AWS_IOBUF_ARENA			(2 * 1024 * 1024)
+/* per-request arenas grow by blocks of this size */
+#define AWS_ARENA_BLOCK			(4 * 1024)
+
+/* connection objects per slab (see slab.h) */
+#define AWS_CONNECTIONS_PER_SLAB	64
+
+/* request and response buffers per slab of the shared buffer pools */
+#define AWS_BUFFERS_PER_SLAB		16
+
+/* transfer strategy thresholds (see transfer.h) */
+#define AWS_INLINE_MAX			(4 * 1024)
+#define AWS_INLINE_LIMIT		(BUFSIZ - 512)
+#define AWS_MEDIUM_MAX			(1024 * 1024)
+
+/* asynchronous I/O for dynamic files */
+#define AWS_AIO_WINDOW			8
+/* chunk size and chunks read by one preadv (--chunk-size, --aio-vector) */
+#define AWS_CHUNK_SIZE			BUFSIZ
+#define AWS_AIO_VECTOR			4
+/* reads per io_submit() and body pieces per sendmsg() */
+#define AWS_AIO_BATCH			32
+#define AWS_SEND_IOV			16
+/* body bytes a response may send per turn of the event loop */
+#define AWS_SEND_QUANTUM		(128 * 1024)
+
+/*
+ * Bandwidth limits: a token bucket holds this many ms of its rate, and no
+ * less than AWS_SHAPER_MIN_BURST bytes; --path-rate may be given this
+ * many times
+ */
+#define AWS_SHAPER_BURST_MS		200
+#define AWS_SHAPER_MIN_BURST		4096
+#define AWS_PATH_RATES			8
+
+/*
+ * Per-client limits: entries of the client table, slots an address may
+ * probe, and requests a client may send at once past --client-rate
+ */
+#define AWS_CLIENT_TABLE		8192
+#define AWS_CLIENT_PROBE		16
+#define AWS_CLIENT_BURST		20
+/* zerocopy chunks wait for ACKs: keep this much in flight per connection */
+#define AWS_ZEROCOPY_INFLIGHT		(256 * 1024)
+#define AWS_AIO_MAX_EVENTS		1024
+
+/* disk reader threads, used when io_submit() blocks */
+#define AWS_READER_THREADS		4
+#define AWS_POOL_RING			256
+#define AWS_AIO_SLOW_USEC		1000
+#define AWS_AIO_PROBE_SAMPLES		64
+
+/* O_DIRECT (--direct) and coalesced (--coalesce) dynamic file reads */
+#define AWS_DIRECT_ALIGN		4096
+#define AWS_BLOCK_SIZE			BUFSIZ
+#define AWS_BLOCK_CACHE			(64 * 1024 * 1024)
+
+/* Cache-Control max-age of served files (--max-age), validator lengths */
+#define AWS_MAX_AGE			3600
+#define AWS_ETAG_LEN			64
+#define AWS_HTTP_DATE_LEN		32
+
+/* precompressed sidecars of static files (see path_index.h) */
+#define AWS_PATH_INDEX			1024
+#define AWS_PATH_INDEX_TTL		10
+
+/* on-the-fly gzip of dynamic files (see gzip_cache.h) */
+#define AWS_GZIP_LEVEL			6
+#define AWS_GZIP_MIN			1024
+#define AWS_GZIP_CHUNK			(64 * 1024)
+#define AWS_GZIP_CACHE			(32 * 1024 * 1024)
+#define AWS_GZIP_BUCKETS		256
+
+/* most body bytes in one chunk of a chunked response (--http-chunk) */
+#define AWS_HTTP_CHUNK			(32 * 1024)
+
+/*
+ * Timing wheel resolution; seconds a client may take to send a request
+ * (--header-timeout) or between requests (--idle-timeout), and bytes per
+ * second a response must move, measured over a window (--min-rate)
+ */
+#define AWS_TIMER_TICK_MS		100
+#define AWS_HEADER_TIMEOUT		10
+#define AWS_IDLE_TIMEOUT		30
+#define AWS_MIN_RATE			512
+#define AWS_RATE_WINDOW			10
+
+/*
+ * CoDel shedding of new connections (--codel): milliseconds a first
+ * request may have waited since accept, and over which it must have
+ * stayed above that before connections are shed
+ */
+#define AWS_CODEL_TARGET		5
+#define AWS_CODEL_INTERVAL		100
+
+/* byte ranges served per request, multipart/byteranges boundary length */
+#define AWS_MAX_RANGES			16
+#define AWS_BOUNDARY_LEN		20
+
+/* splice() engine for dynamic files */
+#define AWS_PIPE_POOL			64
+#define AWS_PIPE_SIZE			(256 * 1024)
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,68 @@
+/*
+ * Asynchronous Web Server - shared block cache for dynamic file reads
+ *
+ * With --direct (O_DIRECT reads bypass the page cache) or --coalesce,
+ * AIO reads of dynamic files go through this cache. Blocks are refcounted
+ * and shared by every connection streaming the same file version, and a
+ * block still being read collects waiters instead of issuing a second
+ * read. A flash crowd on one file therefore reads each block from disk
+ * once; late joiners hit blocks still cached or load their own.
+ */
+
+#ifndef BLOCK_CACHE_H_
+#define BLOCK_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "transfer.h"
+
+enum block_state {
+	BLOCK_EMPTY,
+	BLOCK_LOADING,
+	BLOCK_VALID
+};
+
+/* Notified once the block it waits on is loaded (ok != 0) or failed */
+struct block_waiter {
+	struct block_waiter *next;
+	void (*ready)(struct block_waiter *w, int ok);
+};
+
+struct cache_block {
+	struct aio_op op;
+
+	/* key: file identity and version, block aligned offset */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	off_t offset;
+
+	char *buf;
+	size_t len;
+	enum block_state state;
+	int refs;
+	struct block_waiter *waiters;
+
+	struct cache_block *hnext;
+	struct cache_block *lru_prev;
+	struct cache_block *lru_next;
+};
+
+void block_cache_init(size_t bytes);
+struct cache_block *block_cache_get(const struct stat *st, int fd, off_t offset,
+		struct block_waiter *w);
+void block_cache_put(struct cache_block *b);
+void block_cache_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCK_CACHE_H_ */
@@ -0,0 +1,73 @@
+/*
+ * Asynchronous Web Server - chunked transfer coding
+ *
+ * Bodies whose length is not known when the header goes out, like the
+ * gzip output of gzip_cache.h, are sent to HTTP/1.1 clients as chunks, so
+ * the connection survives the response. The encoder frames the caller's
+ * body iovecs in place: size prefixes and CRLFs become iovecs of their
+ * own between the data ones, and no body byte is copied. A chunk carries
+ * at most --http-chunk bytes and may span several body buffers.
+ *
+ * A chunk is committed once the first byte of its prefix is on the wire;
+ * chunks framed but not reached by a short send are framed again, from
+ * whatever data is then available, on the next call.
+ */
+
+#ifndef CHUNKED_H_
+#define CHUNKED_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "aws.h"
+
+/* hex size and CRLF */
+#define CHUNK_PREFIX_LEN	20
+
+struct chunk_frame {
+	size_t len;
+	int plen;
+	char prefix[CHUNK_PREFIX_LEN];
+};
+
+struct chunked_encoder {
+	size_t chunk_max;
+	/* chunk partly on the wire, and the wire bytes of it sent */
+	struct chunk_frame cur;
+	size_t cur_sent;
+	int cur_open;
+	/* chunks laid out by the last chunked_frame() */
+	struct chunk_frame next[AWS_SEND_IOV];
+	int nnext;
+	/* last chunk and trailers queued */
+	int ended;
+};
+
+void chunked_init(struct chunked_encoder *c, size_t chunk_max);
+
+/*
+ * Frame the n body buffers, which start at the first data byte not yet
+ * sent, into at most max iovecs. Returns the iovecs used; 0 means the
+ * chunk on the wire is complete and there is no body data.
+ */
+int chunked_frame(struct chunked_encoder *c, const struct iovec *body, int n,
+		struct iovec *out, int max);
+
+/* wire bytes of the framed iovecs were sent; returns the body bytes among them */
+size_t chunked_sent(struct chunked_encoder *c, size_t wire);
+
+/*
+ * Last chunk followed by trailers, header lines each ending in CRLF (or
+ * NULL for none). Returns the bytes written to buf.
+ */
+int chunked_end(char *buf, size_t len, const char *trailers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHUNKED_H_ */
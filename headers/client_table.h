@@ -0,0 +1,57 @@
+/*
+ * Asynchronous Web Server - per-client limits
+ *
+ * Clients are told apart by IPv4 address. Past --client-connections open
+ * connections from one address, further ones are answered with the canned
+ * 503 as they are accepted; past --client-rate requests per second (with
+ * bursts of --client-burst) a request is answered 429 before any file is
+ * looked at.
+ *
+ * The table is one array of --client-table 16-byte entries, allocated at
+ * start and never grown, with linear probing from a hash keyed at random.
+ * The request rate is a token bucket kept as its theoretical arrival time
+ * (GCRA), so an entry is the address, its connection count and one
+ * timestamp. An entry with no connection whose bucket is full again holds
+ * nothing worth keeping and is reused by the next address that probes
+ * past it. An address finding no room within AWS_CLIENT_PROBE slots is
+ * served untracked: a flood of addresses costs no memory and cannot evict
+ * clients that are connected.
+ */
+
+#ifndef CLIENT_TABLE_H_
+#define CLIENT_TABLE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct client {
+	/* network byte order, 0 for a slot never used */
+	uint32_t addr;
+	uint32_t connections;
+	/* when the request bucket is full again */
+	uint64_t tat;
+};
+
+void client_table_init(void);
+
+/*
+ * A connection from addr was accepted. Returns -1 if addr is over its
+ * connection limit, else 0 with *c set to its entry (NULL if untracked).
+ */
+int client_table_connect(uint32_t addr, struct client **c);
+void client_table_disconnect(struct client *c);
+
+/* c sent a request: non-zero if it is over its request rate */
+int client_table_request(struct client *c);
+
+void client_table_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLIENT_TABLE_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Asynchronous Web Server - runtime configuration
+ *
+ * Defaults come from aws.h and may be overridden on the command line.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "aws.h"
+
+struct aws_config {
+	/* files up to this size are sent together with the header */
+	size_t inline_max;
+	/* larger files up to this size use the medium transfer tier */
+	size_t medium_max;
+	/* number of AIO chunks kept in flight per connection */
+	int aio_window;
+	/* bytes per AIO chunk, and chunks read by one preadv */
+	size_t chunk_size;
+	int aio_vector;
+	/* engine for dynamic files above medium_max: "aio" or "splice" */
+	const char *dynamic_engine;
+	/* disk reads: "aio", "threads" or "auto" (threads once aio blocks) */
+	const char *disk_engine;
+	int reader_threads;
+	/* AIO reads bypass the page cache, through the shared block cache */
+	int direct;
+	/* buffered AIO reads are shared through the block cache as well */
+	int coalesce;
+	size_t block_cache;
+	/* back the I/O buffer pool with huge pages */
+	int huge_pages;
+	/* aio chunks are sent with MSG_ZEROCOPY */
+	int zerocopy;
+	/* dynamic files are gzipped on the fly at this level, 0 for never */
+	int gzip_level;
+	size_t gzip_cache;
+	/* body bytes per chunk of chunked responses */
+	size_t http_chunk;
+	/* body bytes per send turn, 0 for until the socket is full */
+	size_t send_quantum;
+	/* run queue order: "rr" or "srf" (see send_sched.h) */
+	const char *send_policy;
+	/* bytes per second per connection, path prefix and server, 0 for none */
+	size_t rate_limit;
+	struct {
+		const char *prefix;
+		size_t rate;
+	} path_rate[AWS_PATH_RATES];
+	int path_rates;
+	size_t global_rate;
+	/* per client address, 0 for no limit (see client_table.h) */
+	int client_connections;
+	int client_rate;
+	int client_burst;
+	int client_table;
+	/* seconds until a silent client is dropped, 0 for never */
+	int header_timeout;
+	int idle_timeout;
+	/* bytes per second a response must move, 0 for no minimum */
+	size_t min_rate;
+	/* admission limits, 0 for none (see admission.h) */
+	int max_connections;
+	size_t max_aio_bytes;
+	int max_open_files;
+	/* past a limit: "pause" accepting or answer "503" */
+	const char *overload;
+	/* CoDel on the wait before a first request, in ms; 0 for off */
+	int codel_target;
+	int codel_interval;
+	/* Cache-Control max-age of every response, in seconds */
+	int max_age;
+	/* measure every transfer strategy before serving */
+	int calibrate;
+};
+
+extern struct aws_config config;
+
+void config_parse(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_H_ */
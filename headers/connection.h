@@ -0,0 +1,187 @@
+/*
+ * Asynchronous Web Server - connection handler
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "aws.h"
+#include "arena.h"
+#include "reader_pool.h"
+#include "range.h"
+#include "path_index.h"
+#include "gzip_cache.h"
+#include "chunked.h"
+#include "timer_wheel.h"
+#include "send_sched.h"
+#include "shaper.h"
+#include "client_table.h"
+
+enum connection_state {
+	STATE_INITIAL,
+	STATE_FILE_OPENING,
+	STATE_DATA_RECEIVED,
+	STATE_DATA_SENT,
+	STATE_CONNECTION_CLOSED
+};
+
+/* Request headers the response depends on */
+enum request_header {
+	HEADER_RANGE,
+	HEADER_IF_RANGE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_ACCEPT_ENCODING,
+	HEADER_TE,
+	REQUEST_HEADERS
+};
+
+/* What the timer of a connection is waiting for */
+enum connection_timeout {
+	TIMEOUT_HEADER,
+	TIMEOUT_IDLE,
+	TIMEOUT_RATE,
+	TIMEOUTS
+};
+
+struct aio_chunk;
+
+/*
+ * Structure acting as a connection handler.
+ * Connections come from a slab (see slab.h). Fields touched on every
+ * event come first and fit in two cache lines. Only they are zeroed when a
+ * connection is created; the request data after them is written before use.
+ * Buffers are borrowed from shared pools: the receive buffer while a
+ * request is read and parsed, the send buffer while a response is in
+ * flight, so an idle connection holds neither.
+ */
+struct connection {
+	int sockfd;
+	enum connection_state state;
+
+	/* File information variables */
+	int fd;
+	int dynamic;
+
+	/* Buffers used for receiving requests and sending response headers */
+	char *recv_buffer;
+	char *send_buffer;
+
+	/* Progress of the request and of the response header */
+	size_t recv_len;
+	size_t send_len;
+	size_t send_pos;
+
+	/* Transfer strategy state (see transfer.h) */
+	int engine;
+	int inflight;
+	off_t file_pos;
+	off_t read_pos;
+	uint64_t start_ns;
+	char *map;
+
+	/* Variables used for asynchronous reads */
+	struct aio_chunk *chunks;
+	int chunk_head;
+	int direct_fd;
+
+	/* Pipe borrowed by the splice engine and the bytes parked in it */
+	int pipefd[2];
+	size_t pipe_len;
+
+	/* Cold part: the timeout, set up when the connection is accepted */
+	struct timer timer __attribute__((aligned(AWS_CACHE_LINE)));
+	/* the client, as accepted, and its entry in the client table */
+	struct sockaddr_in peer;
+	struct client *client;
+	enum connection_timeout timeout;
+	/* response bytes sent at the last rate check */
+	off_t rate_mark;
+	/* accepted at, until the first request is dispatched (admission.h) */
+	uint64_t accept_ns;
+	/* run queue, and EPOLLOUT dropped while queued (see send_sched.h) */
+	struct sched_link run;
+	int parked;
+	/* body bytes the current send turn may still move */
+	size_t turn_left;
+	/* bandwidth limits, the wait for them to refill and whether it held
+	 * the response back since the last rate check (see shaper.h) */
+	struct shaper shape;
+	struct timer throttle;
+	int throttled;
+
+	/* request data, valid while send_buffer is held */
+	struct stat st;
+	struct pool_job open_job;
+	char *pathname;
+	/* transient objects of the response, released with send_buffer */
+	struct arena arena;
+
+	/* request headers kept in the arena, NULL if absent */
+	char *headers[REQUEST_HEADERS];
+	/* byte ranges served */
+	struct byte_range *ranges;
+	int nranges;
+	int range_next;
+	/* media type of the file, named again by every multipart part */
+	const char *content_type;
+	/* precompressed variant sent from the path index, if any */
+	struct path_entry *path_entry;
+	int encoding;
+	/* the file has variants, the response depends on Accept-Encoding */
+	int vary;
+	/* request was HTTP/1.1 or later */
+	int http11;
+	/* HEAD: header only, from st; the file is never opened */
+	int head;
+	/* the connection takes another request after this response */
+	int keep_alive;
+	/* body gzipped on the fly (see gzip_cache.h), chunked for HTTP/1.1 */
+	int compress;
+	int chunked;
+	/* the client takes trailers after the last chunk (TE: trailers) */
+	int trailers;
+	struct chunked_encoder *encoder;
+	struct gzip_entry *gzip;
+	/* last segment sent whole, and bytes sent of the one after it */
+	struct gzip_segment *gz_sent;
+	size_t gz_off;
+	struct gzip_waiter gz_wait;
+	/* file range of the body (part) being sent */
+	off_t body_start;
+	off_t body_end;
+
+	/* MSG_ZEROCOPY sends issued and confirmed by the kernel (aio engine) */
+	int zerocopy;
+	uint32_t zc_sent;
+	uint32_t zc_done;
+} __attribute__((aligned(AWS_CACHE_LINE)));
+
+/* Borrowed as send_buffer, the resolved path of the request follows it */
+struct response_buffer {
+	char header[BUFSIZ];
+	char pathname[BUFSIZ];
+};
+
+/* first cold field, everything before it is reset per connection */
+#define CONNECTION_HOT_SIZE	offsetof(struct connection, timer)
+
+_Static_assert(CONNECTION_HOT_SIZE <= 2 * AWS_CACHE_LINE,
+		"hot part of struct connection outgrew two cache lines");
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONNECTION_H_ */
@@ -0,0 +1,115 @@
+/*
+ * Asynchronous Web Server - on-the-fly compression of dynamic files
+ *
+ * With --gzip, dynamic files a client accepts gzip for are compressed as
+ * they are sent. The compressed output of a file version is kept in a
+ * bounded cache, so each version is compressed once and later requests
+ * are served from memory.
+ *
+ * An entry is filled by reader threads (see reader_pool.h), one input
+ * chunk of AWS_GZIP_CHUNK bytes per job, so deflate never runs on the
+ * event loop: a job that finds every reader ring full waits for the next
+ * completion to free a slot. Each job appends the output it produced as
+ * one segment.
+ * Connections send the segments that exist, chunked (see chunked.h) for
+ * HTTP/1.1 clients, and wait for the next job when they catch up with
+ * the compressor.
+ *
+ * Unreferenced entries are evicted least recently used first once the
+ * cache goes over its size; an entry too large for the cache is dropped
+ * when its last reader is done.
+ */
+
+#ifndef GZIP_CACHE_H_
+#define GZIP_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "reader_pool.h"
+
+enum gzip_state {
+	GZIP_RUNNING,
+	GZIP_DONE,
+	GZIP_FAILED
+};
+
+/* Compressed output of one job */
+struct gzip_segment {
+	struct gzip_segment *next;
+	size_t len;
+	char data[];
+};
+
+/* Notified when an entry has more output, or failed */
+struct gzip_waiter {
+	struct gzip_waiter *next;
+	void (*ready)(struct gzip_waiter *w);
+	/* on the waiters of an entry, until called back */
+	int queued;
+};
+
+struct gzip_entry {
+	/* key: file identity and version, content coding */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int encoding;
+
+	enum gzip_state state;
+	int refs;
+	struct gzip_segment *head;
+	struct gzip_segment *tail;
+	/* memory held by the segments */
+	size_t bytes;
+	struct gzip_waiter *waiters;
+
+	/* compressor, only touched by the job in flight */
+	struct pool_job job;
+	int fd;
+	off_t in_pos;
+	char *in;
+	z_stream zs;
+	int zs_ready;
+	struct gzip_segment *fresh;
+	/* next entry whose job waits for room on a reader ring */
+	struct gzip_entry *deferred;
+
+	struct gzip_entry *hnext;
+	struct gzip_entry *lru_prev;
+	struct gzip_entry *lru_next;
+};
+
+void gzip_cache_init(size_t bytes, int level);
+
+/*
+ * Referenced entry for the file open as fd and described by st, in the
+ * given coding. Compression starts on a miss. NULL if the file cannot be
+ * read from a reader thread.
+ */
+struct gzip_entry *gzip_cache_get(int fd, const struct stat *st, int encoding);
+void gzip_cache_put(struct gzip_entry *e);
+
+/*
+ * Call w back once e has grown past its current tail or failed. Returns 0
+ * if w was already waiting, which it keeps doing once.
+ */
+int gzip_cache_wait(struct gzip_entry *e, struct gzip_waiter *w);
+
+/* Hand the jobs that found the reader rings full to the threads again */
+void gzip_cache_resubmit(void);
+
+void gzip_cache_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GZIP_CACHE_H_ */
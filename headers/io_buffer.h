@@ -0,0 +1,32 @@
+/*
+ * Asynchronous Web Server - pool of aligned I/O buffers
+ *
+ * Disk reads land in page-aligned buffers of a few fixed size classes.
+ * Buffers are carved from large anonymous mappings (huge pages with
+ * --huge-pages, when the kernel has them) and recycled through per-class
+ * free lists. They are never zeroed: every byte handed out is overwritten
+ * by the read before anyone looks at it.
+ */
+
+#ifndef IO_BUFFER_H_
+#define IO_BUFFER_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+void io_buffer_init(int huge_pages);
+/* size is rounded up to its class; NULL if it is above the largest one */
+void *io_buffer_get(size_t size);
+/* size must be the one the buffer was asked for */
+void io_buffer_put(void *buf, size_t size);
+void io_buffer_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IO_BUFFER_H_ */
@@ -0,0 +1,80 @@
+/*
+ * Asynchronous Web Server - index of precompressed static files
+ *
+ * A static file foo.js may come with foo.js.gz and foo.js.br next to it.
+ * The index remembers, per file version, which of those sidecars exist
+ * and keeps them open with their fstat() results, so negotiating and
+ * serving a precompressed variant costs no system call beyond the ones
+ * made for the file itself. Sidecars older than the file are ignored.
+ *
+ * The table is direct mapped by path and bounded; an entry is reloaded
+ * when its file changes or after AWS_PATH_INDEX_TTL seconds, unless a
+ * response still reads from it. A file whose slot is held that way is
+ * sent uncompressed.
+ */
+
+#ifndef PATH_INDEX_H_
+#define PATH_INDEX_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* content codings in order of preference on equal q-values */
+enum content_encoding {
+	ENCODING_IDENTITY,
+	ENCODING_GZIP,
+	ENCODING_BR,
+	ENCODINGS
+};
+
+struct path_entry {
+	uint64_t hash;
+	/* version of the file the sidecars were checked against */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	time_t loaded;
+	int refs;
+	/*
+	 * bit e set when fd[e] and st[e] hold the sidecar for encoding e;
+	 * st[ENCODING_IDENTITY] is what fstat() said of the file itself
+	 */
+	unsigned int variants;
+	int fd[ENCODINGS];
+	struct stat st[ENCODINGS];
+};
+
+extern const char *const encoding_names[ENCODINGS];
+
+void path_index_init(size_t entries);
+
+/*
+ * Referenced entry for path, whose file fstat() described as st. NULL
+ * when the slot is held by another file still being sent.
+ */
+struct path_entry *path_index_get(const char *path, const struct stat *st);
+void path_index_put(struct path_entry *e);
+
+/*
+ * Metadata of path as last loaded, without a system call: for HEAD,
+ * which does not open the file. -1 when path has no entry or it is due
+ * for a reload; a file changed since may show for AWS_PATH_INDEX_TTL.
+ */
+int path_index_lookup(const char *path, struct stat *st);
+
+/* Best of the variants the Accept-Encoding header accepts */
+enum content_encoding encoding_negotiate(const char *accept,
+		unsigned int variants);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PATH_INDEX_H_ */
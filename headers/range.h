@@ -0,0 +1,55 @@
+/*
+ * Asynchronous Web Server - HTTP byte ranges
+ *
+ * A Range header is resolved against the file size into up to
+ * AWS_MAX_RANGES byte ranges. One range is answered with a plain 206,
+ * several with a multipart/byteranges body: every part is preceded by a
+ * small header naming its Content-Range, and a closing delimiter follows
+ * the last one. The transfer engines send the parts one after the other.
+ */
+
+#ifndef RANGE_H_
+#define RANGE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* [start, end) of the file */
+struct byte_range {
+	off_t start;
+	off_t end;
+};
+
+/*
+ * Parse the value of a Range header for a file of size bytes.
+ * Returns the number of ranges stored in r, 0 when the header is to be
+ * ignored (malformed, or more than max ranges) and -1 when none of the
+ * ranges is satisfiable (416).
+ */
+int range_parse(const char *spec, off_t size, struct byte_range *r, int max);
+
+/* multipart/byteranges boundary of the file in st, AWS_BOUNDARY_LEN chars */
+void range_boundary(const struct stat *st, char *buf);
+
+/*
+ * Header introducing part r of a multipart body, which names the media
+ * type of the file again, and the closing one
+ */
+int range_part_header(char *buf, size_t len, const struct stat *st,
+		const char *type, const struct byte_range *r);
+int range_closing(char *buf, size_t len, const struct stat *st);
+
+/* Content-Length of the multipart body for the n ranges in r */
+off_t range_multipart_length(const struct stat *st, const char *type,
+		const struct byte_range *r, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RANGE_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Asynchronous Web Server - disk reader threads
+ *
+ * Fallback for filesystems where io_submit() on buffered files reads
+ * synchronously. Worker threads run pread()/preadv()/open()+fstat()/stat() for
+ * the event loop. Jobs reach each worker through its own lock-free SPSC ring, and
+ * results come back on one lock-free MPSC stack. An eventfd in the epoll
+ * set tells the loop that results are waiting.
+ *
+ * The same workers run CPU-bound jobs (POOL_CALL) that must not stall the
+ * loop; those may be queued while disk reads still use AIO.
+ */
+
+#ifndef READER_POOL_H_
+#define READER_POOL_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+enum pool_op {
+	POOL_READ,
+	POOL_READV,
+	POOL_OPEN,
+	POOL_STAT,
+	POOL_CALL
+};
+
+struct pool_job {
+	struct pool_job *next;
+	enum pool_op op;
+
+	/* POOL_READ */
+	int fd;
+	void *buf;
+	size_t len;
+	off_t offset;
+
+	/* POOL_READV, same fd and offset */
+	const struct iovec *iov;
+	int iovcnt;
+
+	/* POOL_OPEN: fstat() result goes to *st; POOL_STAT: stat() only */
+	const char *path;
+	struct stat *st;
+
+	/* POOL_CALL: runs on the worker thread and sets res */
+	void (*run)(struct pool_job *job);
+
+	/* bytes read, new fd or 0; -errno on failure */
+	long res;
+
+	/* runs on the event loop thread */
+	void (*complete)(struct pool_job *job);
+};
+
+void reader_pool_init(int threads, int notify_fd);
+int reader_pool_start(void);
+int reader_pool_spawn(void);
+int reader_pool_active(void);
+int reader_pool_submit(struct pool_job *job);
+void reader_pool_complete(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* READER_POOL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * Asynchronous Web Server - send scheduling
+ *
+ * A response moves at most --send-quantum body bytes per turn. When the
+ * quantum is spent with the socket still taking data, the engine yields
+ * (TRANSFER_YIELD) and the connection joins the run queue instead of
+ * holding the event loop. The loop gives one queued connection its next
+ * turn for each event it handles, so a small response never waits behind
+ * more than a quantum of each bulk download.
+ *
+ * --send-policy=rr keeps the run queue as one FIFO: round robin. With srf
+ * (shortest remaining first) connections queue by the power of two of the
+ * bytes they have left and the turn goes to the smallest class, which
+ * minimizes mean completion time; the largest responses then wait for as
+ * long as smaller ones keep coming.
+ */
+
+#ifndef SEND_SCHED_H_
+#define SEND_SCHED_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define SCHED_CLASSES		64
+
+/* Run queue link, embedded in the connection */
+struct sched_link {
+	struct sched_link *next;
+	struct sched_link *prev;
+	int class;
+};
+
+void send_sched_init(void);
+
+/* Queue l at the back of its class; remaining is the bytes it has left */
+void send_sched_push(struct sched_link *l, uint64_t remaining);
+/* Next link to run, NULL if the queue is empty */
+struct sched_link *send_sched_pop(void);
+void send_sched_remove(struct sched_link *l);
+int send_sched_empty(void);
+
+void send_sched_stats_dump(FILE *f);
+
+static inline void sched_link_init(struct sched_link *l)
+{
+	l->next = l->prev = NULL;
+}
+
+static inline int sched_queued(const struct sched_link *l)
+{
+	return l->next != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEND_SCHED_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Asynchronous Web Server - bandwidth shaping
+ *
+ * Response bodies draw on up to three token buckets: one per connection
+ * (--rate-limit), one per path prefix shared by every response under it
+ * (--path-rate=PREFIX:RATE, first match) and one for the whole server
+ * (--global-rate). A bucket holds AWS_SHAPER_BURST_MS worth of its rate.
+ *
+ * The send scheduler (send_sched.h) sizes each turn to the tokens every
+ * bucket has left. A connection finding one empty sleeps on a precise
+ * timer (timer_wheel.h) until it holds AWS_SHAPER_MIN_BURST again, or
+ * what the response has left, and then queues for its turn again;
+ * nothing blocks the loop. The per-connection rate is also handed to the
+ * kernel as SO_MAX_PACING_RATE, which spreads the packets of each turn.
+ */
+
+#ifndef SHAPER_H_
+#define SHAPER_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct token_bucket {
+	/* bytes per second, 0 for no limit, and the most it holds */
+	uint64_t rate;
+	uint64_t burst;
+	uint64_t tokens;
+	/* last refill */
+	uint64_t stamp;
+};
+
+/* The limits a response is subject to */
+struct shaper {
+	struct token_bucket own;
+	struct token_bucket *path;
+};
+
+void token_bucket_init(struct token_bucket *b, uint64_t rate, uint64_t burst);
+/* Tokens available now, after refilling */
+uint64_t token_bucket_refill(struct token_bucket *b, uint64_t now);
+/* ms until the bucket holds want tokens, 0 if it does */
+unsigned int token_bucket_delay(const struct token_bucket *b, uint64_t want);
+
+void shaper_init(void);
+
+/* A new connection, limited to --rate-limit; paces sockfd accordingly */
+void shaper_connection(struct shaper *s, int sockfd);
+/* The response is for path: pick its prefix bucket */
+void shaper_attach(struct shaper *s, const char *path);
+
+/* Body bytes the limits allow of a turn of quantum, 0 to wait */
+size_t shaper_budget(struct shaper *s, size_t quantum);
+/* ms until every limit allows a send worth the wait of up to left bytes */
+unsigned int shaper_delay(const struct shaper *s, uint64_t left);
+/* bytes were sent out of the last budget */
+void shaper_charge(struct shaper *s, size_t bytes);
+/* the last budget came out 0 */
+void shaper_throttled(void);
+
+void shaper_stats_dump(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHAPER_H_ */
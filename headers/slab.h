@@ -0,0 +1,40 @@
+/*
+ * Asynchronous Web Server - slab allocator for fixed-size objects
+ *
+ * Objects are carved out of anonymous mappings and recycled through a
+ * free list, so creating one costs neither malloc() nor memset(). Pages
+ * of an object nobody touched stay unbacked.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_		1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct slab_cache {
+	const char *name;
+	size_t size;
+	size_t per_slab;
+	void *free;
+
+	size_t slabs;
+	size_t in_use;
+	size_t high_water;
+};
+
+void slab_cache_init(struct slab_cache *c, const char *name, size_t size,
+		size_t align, size_t per_slab);
+void *slab_alloc(struct slab_cache *c);
+void slab_free(struct slab_cache *c, void *obj);
+void slab_cache_dump(FILE *f, const struct slab_cache *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAB_H_ */
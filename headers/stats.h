@@ -0,0 +1,43 @@
+/*
+ * Asynchronous Web Server - counters and latency histograms
+ */
+
+#ifndef STATS_H_
+#define STATS_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* bucket i holds samples in [2^i, 2^(i+1)) microseconds */
+#define HIST_BUCKETS		32
+
+struct histogram {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long long bucket[HIST_BUCKETS];
+};
+
+/* monotonic time in nanoseconds */
+static inline uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void hist_add(struct histogram *h, uint64_t usec);
+uint64_t hist_percentile(const struct histogram *h, double p);
+void hist_dump(FILE *f, const char *name, const struct histogram *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Asynchronous Web Server - connection timeouts
+ *
+ * A hierarchical timing wheel: TIMER_LEVELS wheels of TIMER_SLOTS lists,
+ * each slot of level n spanning TIMER_SLOTS^n ticks of AWS_TIMER_TICK_MS.
+ * Timers are intrusive and doubly linked, so arming and cancelling are
+ * O(1) whatever the number of connections; a timer far in the future
+ * moves down a level each time its slot comes round (at most
+ * TIMER_LEVELS - 1 times) until it fires from level 0.
+ *
+ * The wheel turns on one timerfd in the epoll set, ticking only while
+ * some timer is pending. Timers fire on the event loop thread and may
+ * arm or cancel any timer, themselves included.
+ *
+ * Waits a tick is too coarse for, like a throttled connection's few
+ * milliseconds, take precise timers instead: kept in a list by deadline
+ * next to the wheel, they set the same timerfd to go off early for the
+ * first of them. Inserting looks from the latest deadline back, which is
+ * O(1) while deadlines come in about the order they are armed.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define TIMER_SLOT_BITS		6
+#define TIMER_SLOTS		(1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS		4
+
+struct timer {
+	struct timer *next;
+	/* link pointing at this timer, NULL when not pending */
+	struct timer **pprev;
+	/* tick it fires at, or nanosecond deadline of a precise timer */
+	uint64_t expires;
+	void (*fire)(struct timer *t);
+};
+
+/* Returns the timerfd to poll for input */
+int timer_wheel_init(void);
+
+/* Turn the wheel up to now; call when the timerfd is readable */
+void timer_wheel_run(void);
+
+void timer_init(struct timer *t, void (*fire)(struct timer *t));
+
+/* (Re)arm t to fire in ms milliseconds, rounded up to whole ticks */
+void timer_arm(struct timer *t, unsigned int ms);
+/* (Re)arm t to fire in ms milliseconds, to the millisecond */
+void timer_arm_precise(struct timer *t, unsigned int ms);
+void timer_cancel(struct timer *t);
+
+static inline int timer_pending(const struct timer *t)
+{
+	return t->pprev != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_WHEEL_H_ */
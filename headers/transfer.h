@@ -0,0 +1,130 @@
+/*
+ * Asynchronous Web Server - transfer strategies
+ *
+ * Every response body is pushed by one of the engines below, picked by
+ * file size and folder:
+ *   - inline:   tiny files are read into send_buffer and leave together
+ *               with the response header in a single send();
+ *   - sendfile: static files are sent zero-copy straight from the page cache;
+ *   - mmap:     medium dynamic files are sent from a read-only mapping;
+ *   - aio:      large dynamic files are read with a window of pipelined
+ *               libaio reads and sent as chunks complete; with --direct
+ *               (O_DIRECT) or --coalesce the reads go through the shared
+ *               block_cache.h;
+ *   - splice:   alternative to aio, file pages move through a pooled pipe
+ *               to the socket without a user-space copy;
+ *   With --direct or reader threads doing the disk reads, every dynamic
+ *   file past inline goes to aio, which is all that keeps the loop off
+ *   the disk.
+ *   - gzip:     dynamic files gzipped on the fly (--gzip) are sent from the
+ *               compressed output cache of gzip_cache.h as it fills.
+ * Dynamic content has to pass through user space, so it never uses sendfile.
+ *
+ * Engines send the response header themselves: gathered with the first
+ * body bytes into one sendmsg() where the body is in memory, or sent with
+ * MSG_MORE ahead of sendfile()/splice() so both share the first segment.
+ *
+ * Engines move at most turn_left body bytes of the connection per call and
+ * yield once it is spent, see send_sched.h.
+ *
+ * The body is the file range [body_start, body_end) of the connection:
+ * the whole file, or the byte range a client asked for. Multipart ranges
+ * are sent by the same engine one part at a time (see range.h).
+ */
+
+#ifndef TRANSFER_H_
+#define TRANSFER_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <libaio.h>
+
+#include "connection.h"
+#include "reader_pool.h"
+#include "stats.h"
+
+enum transfer_status {
+	TRANSFER_DONE,		/* whole body was sent */
+	TRANSFER_AGAIN,		/* socket is full, wait for EPOLLOUT */
+	TRANSFER_YIELD,		/* turn is over, more can go right away */
+	TRANSFER_WAIT,		/* waiting for disk, engine calls wakeup() */
+	TRANSFER_ERROR
+};
+
+enum transfer_kind {
+	TRANSFER_INLINE,
+	TRANSFER_SENDFILE,
+	TRANSFER_MMAP,
+	TRANSFER_AIO,
+	TRANSFER_SPLICE,
+	TRANSFER_GZIP,
+	TRANSFER_KINDS
+};
+
+struct transfer_engine {
+	const char *name;
+	/* prepare the body; -1 on error */
+	int (*start)(struct connection *conn);
+	/* push as much as the socket takes */
+	enum transfer_status (*send)(struct connection *conn);
+	/* release engine resources; called once nothing is in flight */
+	void (*finish)(struct connection *conn);
+};
+
+struct transfer_stats {
+	unsigned long long completed;
+	unsigned long long failed;
+	unsigned long long bytes;
+	/* send-side system calls, header included */
+	unsigned long long syscalls;
+	struct histogram latency;
+};
+
+/*
+ * Asynchronous read described by iocb; it runs on the kernel AIO context
+ * or on a reader thread. complete() runs from transfer_aio_complete().
+ */
+struct aio_op {
+	struct iocb iocb;
+	struct pool_job job;
+	void (*complete)(struct aio_op *op, long res);
+};
+
+/* callbacks into the event loop */
+struct transfer_hooks {
+	/* disk data is ready, resume sending on conn */
+	void (*wakeup)(struct connection *conn);
+	/* last outstanding read of a closed connection finished */
+	void (*release)(struct connection *conn);
+};
+
+/* returns the eventfd signalling AIO and reader thread completions */
+int transfer_init(const struct transfer_hooks *hooks);
+int transfer_aio_submit(struct aio_op *op);
+int transfer_aio_submit_batch(struct aio_op **ops, int n);
+void transfer_aio_complete(void);
+/* bytes of disk reads submitted and not completed yet */
+size_t transfer_aio_inflight(void);
+
+int transfer_start(struct connection *conn);
+enum transfer_status transfer_send(struct connection *conn);
+/* flush send_buffer alone; more keeps it queued for the body (MSG_MORE) */
+enum transfer_status transfer_send_header(struct connection *conn, int more);
+void transfer_finish(struct connection *conn);
+int transfer_busy(const struct connection *conn);
+/* body bytes sent so far, for the minimum rate check */
+off_t transfer_progress(const struct connection *conn);
+/* file bytes of the body not sent yet, for shortest remaining first */
+off_t transfer_remaining(const struct connection *conn);
+
+void transfer_stats_dump(FILE *f);
+void transfer_calibrate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSFER_H_ */
@@ -0,0 +1,48 @@
+/*
+ * Asynchronous Web Server - cache validators
+ *
+ * Every file version gets a strong ETag built from its inode, size and
+ * modification time, all known from fstat(). Responses name it along
+ * with Last-Modified and Cache-Control, and conditional requests
+ * (If-None-Match, If-Modified-Since) for an unchanged file are answered
+ * with 304 and no body. If-Range decides whether a Range is honoured.
+ */
+
+#ifndef VALIDATOR_H_
+#define VALIDATOR_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * ETag, Last-Modified and Cache-Control header lines for the file in st.
+ * variant names a content coding applied on the fly, NULL for none.
+ */
+int validator_headers(char *buf, size_t len, const struct stat *st,
+		const char *variant);
+
+/*
+ * Non-zero when the client's copy of the file in st (as variant) is
+ * current, so the answer is 304. NULL stands for a missing header.
+ */
+int validator_not_modified(const struct stat *st, const char *variant,
+		const char *if_none_match, const char *if_modified_since);
+
+/* Non-zero when ranges may be served under the If-Range header, if any */
+int validator_range_ok(const struct stat *st, const char *if_range);
+
+/* IMF-fixdate, and any of the three HTTP date formats back; -1 if invalid */
+int http_date_format(char *buf, size_t len, time_t t);
+time_t http_date_parse(const char *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VALIDATOR_H_ */
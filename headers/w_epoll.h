@@ -155,6 +155,17 @@ static inline int w_epoll_update_ptr_inout(int epollfd, int fd, void *ptr)
 	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+static inline int w_epoll_update_ptr_none(int epollfd, int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	/* only EPOLLERR/EPOLLHUP are reported */
+	ev.events = 0;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 static inline int w_epoll_remove_ptr(int epollfd, int fd, void *ptr)
 {
 	struct epoll_event ev;
@@ -174,6 +185,13 @@ static inline int w_epoll_wait_infinite(int epollfd, struct epoll_event *rev)
 {
 	return epoll_wait(epollfd, rev, 1, EPOLL_TIMEOUT_INFINITE);
 }
+
+/* Returns 0 if nothing happened within ms milliseconds */
+static inline int w_epoll_wait_timeout(int epollfd, struct epoll_event *rev,
+		int ms)
+{
+	return epoll_wait(epollfd, rev, 1, ms);
+}
 #ifdef __cplusplus
 }
 #endif
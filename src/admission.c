@@ -0,0 +1,164 @@
+/*
+ * Asynchronous Web Server - admission control
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../headers/config.h"
+#include "../headers/stats.h"
+#include "../headers/admission.h"
+
+static const char *const limit_names[ADMISSION_LIMITS] = {
+	[LIMIT_CONNECTIONS] = "connections",
+	[LIMIT_AIO_BYTES] = "aio_bytes",
+	[LIMIT_OPEN_FILES] = "open_files",
+};
+
+static int overloaded;
+static uint64_t overload_start;
+/* connections open when accept() last ran out of descriptors, 0 if never */
+static int fd_limit;
+
+/* CoDel (RFC 8289), with first requests for packets */
+static struct {
+	int dropping;
+	/* when the sojourn may be judged too long for an interval, 0 if short */
+	uint64_t first_above;
+	uint64_t drop_next;
+	unsigned int count;
+	unsigned int last_count;
+} codel;
+
+static struct {
+	/* times each limit started an overload */
+	unsigned long long episodes[ADMISSION_LIMITS];
+	unsigned long long rejected;
+	uint64_t overload_ns;
+	/* connections shed by CoDel, and how long first requests waited */
+	unsigned long long shed;
+	struct histogram sojourn;
+} stats;
+
+/* Tighter of the two limits, 0 meaning none */
+static size_t limit_min(size_t a, size_t b)
+{
+	if (a == 0 || (b != 0 && b < a))
+		return b;
+
+	return a;
+}
+
+int admission_overloaded(const struct admission_load *load)
+{
+	size_t value[ADMISSION_LIMITS], limit[ADMISSION_LIMITS];
+	int i, over = -1, clear = 1;
+
+	value[LIMIT_CONNECTIONS] = load->connections;
+	limit[LIMIT_CONNECTIONS] = limit_min(config.max_connections, fd_limit);
+	value[LIMIT_AIO_BYTES] = load->aio_bytes;
+	limit[LIMIT_AIO_BYTES] = config.max_aio_bytes;
+	value[LIMIT_OPEN_FILES] = load->open_files;
+	limit[LIMIT_OPEN_FILES] = config.max_open_files;
+
+	for (i = 0; i < ADMISSION_LIMITS; i++) {
+		if (limit[i] == 0)
+			continue;
+		if (value[i] >= limit[i] && over < 0)
+			over = i;
+		/* low water mark: 7/8 of the limit */
+		if (value[i] >= limit[i] - limit[i] / 8)
+			clear = 0;
+	}
+
+	if (!overloaded && over >= 0) {
+		overloaded = 1;
+		overload_start = stats_now_ns();
+		stats.episodes[over]++;
+	} else if (overloaded && clear) {
+		overloaded = 0;
+		stats.overload_ns += stats_now_ns() - overload_start;
+		/* descriptors may have been freed elsewhere, learn it again */
+		fd_limit = 0;
+	}
+
+	return overloaded;
+}
+
+void admission_fd_exhausted(int connections)
+{
+	fd_limit = connections > 1 ? connections : 1;
+}
+
+void admission_rejected(void)
+{
+	stats.rejected++;
+}
+
+/* Drops come closer together the longer the queue stays */
+static uint64_t codel_control_law(uint64_t t, unsigned int count)
+{
+	return t + (uint64_t) (config.codel_interval * 1000000ULL / sqrt(count));
+}
+
+int admission_codel(uint64_t sojourn, uint64_t now)
+{
+	uint64_t interval = config.codel_interval * 1000000ULL;
+	int ok_to_drop = 0, shed = 0;
+
+	hist_add(&stats.sojourn, sojourn / 1000);
+
+	if (sojourn < config.codel_target * 1000000ULL)
+		codel.first_above = 0;
+	else if (codel.first_above == 0)
+		codel.first_above = now + interval;
+	else if (now >= codel.first_above)
+		ok_to_drop = 1;
+
+	if (codel.dropping) {
+		if (!ok_to_drop) {
+			codel.dropping = 0;
+		} else if (now >= codel.drop_next) {
+			shed = 1;
+			codel.count++;
+			codel.drop_next = codel_control_law(codel.drop_next,
+					codel.count);
+		}
+	} else if (ok_to_drop) {
+		unsigned int delta = codel.count - codel.last_count;
+
+		shed = 1;
+		codel.dropping = 1;
+		/* back soon after the last episode: carry on at its rate */
+		codel.count = delta > 1 && now - codel.drop_next < 16 * interval ?
+			delta : 1;
+		codel.drop_next = codel_control_law(now, codel.count);
+		codel.last_count = codel.count;
+	}
+
+	stats.shed += shed;
+
+	return shed;
+}
+
+void admission_stats_dump(FILE *f)
+{
+	uint64_t ns = stats.overload_ns;
+	int i;
+
+	if (overloaded)
+		ns += stats_now_ns() - overload_start;
+
+	fprintf(f, "admission: overloaded=%d time=%.3fs rejected=%llu",
+			overloaded, ns / 1e9, stats.rejected);
+	for (i = 0; i < ADMISSION_LIMITS; i++)
+		fprintf(f, " %s=%llu", limit_names[i], stats.episodes[i]);
+	fprintf(f, "\n");
+
+	if (config.codel_target > 0) {
+		fprintf(f, "codel: dropping=%d shed=%llu\n",
+				codel.dropping, stats.shed);
+		hist_dump(f, "sojourn", &stats.sojourn);
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * Asynchronous Web Server - per-request bump arena
+ */
+
+#include <stdio.h>
+
+#include "../headers/aws.h"
+#include "../headers/arena.h"
+#include "../headers/io_buffer.h"
+
+#define ARENA_ALIGN	16
+#define ARENA_ROUND(n)	(((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+struct arena_block {
+	char *prev;
+	size_t size;
+};
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *hdr;
+	size_t need;
+	char *p;
+
+	size = ARENA_ROUND(size);
+	if (a->block == NULL || a->used + size > a->size) {
+		need = ARENA_ROUND(sizeof(*hdr)) + size;
+		if (need < AWS_ARENA_BLOCK)
+			need = AWS_ARENA_BLOCK;
+
+		p = io_buffer_get(need);
+		if (p == NULL)
+			return NULL;
+
+		hdr = (struct arena_block *) p;
+		hdr->prev = a->block;
+		hdr->size = need;
+		a->block = p;
+		a->size = need;
+		a->used = ARENA_ROUND(sizeof(*hdr));
+	}
+
+	p = a->block + a->used;
+	a->used += size;
+
+	return p;
+}
+
+void arena_release(struct arena *a)
+{
+	while (a->block != NULL) {
+		struct arena_block *hdr = (struct arena_block *) a->block;
+		char *prev = hdr->prev;
+
+		io_buffer_put(a->block, hdr->size);
+		a->block = prev;
+	}
+	a->size = a->used = 0;
+}
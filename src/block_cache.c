@@ -0,0 +1,247 @@
+/*
+ * Asynchronous Web Server - shared block cache for dynamic file reads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/block_cache.h"
+
+static struct cache_block *blocks;
+static size_t nblocks;
+
+static struct cache_block **hash;
+static size_t hash_mask;
+
+/* Unreferenced blocks, most recently used first */
+static struct cache_block *lru_head;
+static struct cache_block *lru_tail;
+
+static struct {
+	unsigned long long hits;
+	unsigned long long joins;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long exhausted;
+	unsigned long long errors;
+	unsigned long long bytes_read;
+	unsigned long long bytes_shared;
+} stats;
+
+static size_t block_hash(dev_t dev, ino_t ino, off_t offset)
+{
+	unsigned long long h = (unsigned long long) ino * 0x9E3779B97F4A7C15ULL;
+
+	h ^= (unsigned long long) dev + (offset / AWS_BLOCK_SIZE) * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 29;
+
+	return h & hash_mask;
+}
+
+static int block_matches(const struct cache_block *b, const struct stat *st,
+		off_t offset)
+{
+	return b->ino == st->st_ino && b->dev == st->st_dev &&
+		b->offset == offset && b->size == st->st_size &&
+		b->mtime.tv_sec == st->st_mtim.tv_sec &&
+		b->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void lru_unlink(struct cache_block *b)
+{
+	if (b->lru_prev != NULL)
+		b->lru_prev->lru_next = b->lru_next;
+	else
+		lru_head = b->lru_next;
+	if (b->lru_next != NULL)
+		b->lru_next->lru_prev = b->lru_prev;
+	else
+		lru_tail = b->lru_prev;
+	b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push(struct cache_block *b)
+{
+	b->lru_prev = NULL;
+	b->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = b;
+	else
+		lru_tail = b;
+	lru_head = b;
+}
+
+static void hash_unlink(struct cache_block *b)
+{
+	struct cache_block **p = &hash[block_hash(b->dev, b->ino, b->offset)];
+
+	while (*p != NULL && *p != b)
+		p = &(*p)->hnext;
+	if (*p != NULL)
+		*p = b->hnext;
+	b->hnext = NULL;
+	b->state = BLOCK_EMPTY;
+}
+
+/*
+ * Read finished: hand the block to everyone waiting on it.
+ */
+static void block_loaded(struct aio_op *op, long res)
+{
+	struct cache_block *b = (struct cache_block *) op;
+	struct block_waiter *w = b->waiters;
+	int ok = res >= (long) b->len;
+
+	b->waiters = NULL;
+	if (ok) {
+		b->state = BLOCK_VALID;
+	} else {
+		stats.errors++;
+		hash_unlink(b);
+	}
+
+	while (w != NULL) {
+		struct block_waiter *next = w->next;
+
+		w->ready(w, ok);
+		w = next;
+	}
+}
+
+void block_cache_init(size_t bytes)
+{
+	size_t i, buckets = 1;
+	char *mem;
+	int rc;
+
+	nblocks = bytes / AWS_BLOCK_SIZE;
+	if (nblocks == 0)
+		nblocks = 1;
+
+	blocks = calloc(nblocks, sizeof(*blocks));
+	DIE(blocks == NULL, "calloc");
+
+	/* O_DIRECT wants buffers aligned to the logical block size */
+	rc = posix_memalign((void **) &mem, AWS_DIRECT_ALIGN,
+			nblocks * AWS_BLOCK_SIZE);
+	DIE(rc != 0, "posix_memalign");
+
+	while (buckets < nblocks)
+		buckets <<= 1;
+	hash = calloc(buckets, sizeof(*hash));
+	DIE(hash == NULL, "calloc");
+	hash_mask = buckets - 1;
+
+	for (i = 0; i < nblocks; i++) {
+		blocks[i].buf = mem + i * AWS_BLOCK_SIZE;
+		blocks[i].op.complete = block_loaded;
+		lru_push(&blocks[i]);
+	}
+}
+
+/*
+ * Return a referenced block holding offset of the file in st.
+ * BLOCK_VALID blocks are ready; for BLOCK_LOADING ones w is queued and
+ * called back. NULL means the cache is full of pinned blocks or the read
+ * failed; the caller reads on its own then.
+ */
+struct cache_block *block_cache_get(const struct stat *st, int fd, off_t offset,
+		struct block_waiter *w)
+{
+	struct cache_block *b;
+	size_t h = block_hash(st->st_dev, st->st_ino, offset);
+	size_t aligned;
+	ssize_t rc;
+
+	for (b = hash[h]; b != NULL; b = b->hnext)
+		if (block_matches(b, st, offset))
+			break;
+
+	if (b != NULL) {
+		if (b->refs++ == 0)
+			lru_unlink(b);
+		stats.bytes_shared += b->len;
+		if (b->state == BLOCK_VALID) {
+			stats.hits++;
+		} else {
+			stats.joins++;
+			w->next = b->waiters;
+			b->waiters = w;
+		}
+		return b;
+	}
+
+	/* Miss: recycle the least recently used idle block */
+	b = lru_tail;
+	if (b == NULL) {
+		stats.exhausted++;
+		return NULL;
+	}
+	lru_unlink(b);
+	if (b->state != BLOCK_EMPTY) {
+		stats.evictions++;
+		hash_unlink(b);
+	}
+	stats.misses++;
+
+	b->dev = st->st_dev;
+	b->ino = st->st_ino;
+	b->size = st->st_size;
+	b->mtime = st->st_mtim;
+	b->offset = offset;
+	b->len = st->st_size - offset < AWS_BLOCK_SIZE ?
+		st->st_size - offset : AWS_BLOCK_SIZE;
+	stats.bytes_read += b->len;
+	b->refs = 1;
+	b->state = BLOCK_LOADING;
+	b->waiters = NULL;
+	b->hnext = hash[h];
+	hash[h] = b;
+
+	/* The trailing partial block is read whole, the kernel stops at EOF */
+	aligned = (b->len + AWS_DIRECT_ALIGN - 1) & ~((size_t) AWS_DIRECT_ALIGN - 1);
+	io_prep_pread(&b->op.iocb, fd, b->buf, aligned, offset);
+	if (transfer_aio_submit(&b->op) == 0) {
+		w->next = NULL;
+		b->waiters = w;
+		return b;
+	}
+
+	rc = pread(fd, b->buf, aligned, offset);
+	if (rc < (ssize_t) b->len) {
+		stats.errors++;
+		hash_unlink(b);
+		block_cache_put(b);
+		return NULL;
+	}
+	b->state = BLOCK_VALID;
+
+	return b;
+}
+
+void block_cache_put(struct cache_block *b)
+{
+	if (--b->refs == 0)
+		lru_push(b);
+}
+
+void block_cache_stats_dump(FILE *f)
+{
+	if (blocks == NULL)
+		return;
+
+	fprintf(f, "block cache: blocks=%zu hits=%llu joins=%llu misses=%llu "
+			"evictions=%llu exhausted=%llu errors=%llu\n",
+			nblocks, stats.hits, stats.joins, stats.misses,
+			stats.evictions, stats.exhausted, stats.errors);
+	fprintf(f, "block cache: read=%llu shared=%llu fan-out=%.2f\n",
+			stats.bytes_read, stats.bytes_shared,
+			stats.bytes_read ? (double) (stats.bytes_read +
+				stats.bytes_shared) / stats.bytes_read : 0.0);
+}
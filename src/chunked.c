@@ -0,0 +1,157 @@
+/*
+ * Asynchronous Web Server - chunked transfer coding
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "../headers/aws.h"
+#include "../headers/chunked.h"
+
+static const char crlf[] = "\r\n";
+
+/* Body buffers being framed, from the first byte not framed yet */
+struct body_cursor {
+	const struct iovec *iov;
+	int n;
+	int i;
+	size_t off;
+};
+
+/* data bytes of chunk f among its first sent wire bytes */
+static size_t data_sent(const struct chunk_frame *f, size_t sent)
+{
+	if (sent <= (size_t) f->plen)
+		return 0;
+	sent -= f->plen;
+
+	return sent < f->len ? sent : f->len;
+}
+
+/*
+ * Append the wire bytes of chunk f past its first skip ones to out,
+ * taking the unsent data from the cursor. -1 once out is full.
+ */
+static int frame_chunk(const struct chunk_frame *f, size_t skip,
+		struct body_cursor *b, struct iovec *out, int *o, int max)
+{
+	size_t data = f->len - data_sent(f, skip), take;
+
+	if (skip < (size_t) f->plen) {
+		if (*o == max)
+			return -1;
+		out[*o].iov_base = (char *) f->prefix + skip;
+		out[(*o)++].iov_len = f->plen - skip;
+		skip = 0;
+	} else {
+		skip -= f->plen;
+		skip = skip > f->len ? skip - f->len : 0;
+	}
+
+	while (data > 0) {
+		const struct iovec *v = &b->iov[b->i];
+
+		if (*o == max || b->i == b->n)
+			return -1;
+		take = v->iov_len - b->off;
+		if (take > data)
+			take = data;
+		out[*o].iov_base = (char *) v->iov_base + b->off;
+		out[(*o)++].iov_len = take;
+		data -= take;
+		b->off += take;
+		if (b->off == v->iov_len) {
+			b->i++;
+			b->off = 0;
+		}
+	}
+
+	if (*o == max)
+		return -1;
+	out[*o].iov_base = (char *) crlf + skip;
+	out[(*o)++].iov_len = 2 - skip;
+
+	return 0;
+}
+
+void chunked_init(struct chunked_encoder *c, size_t chunk_max)
+{
+	c->chunk_max = chunk_max;
+	c->cur_open = 0;
+	c->cur_sent = 0;
+	c->nnext = 0;
+	c->ended = 0;
+}
+
+int chunked_frame(struct chunked_encoder *c, const struct iovec *body, int n,
+		struct iovec *out, int max)
+{
+	struct body_cursor b = { body, n, 0, 0 };
+	size_t avail = 0;
+	int o = 0, i;
+
+	for (i = 0; i < n; i++)
+		avail += body[i].iov_len;
+	c->nnext = 0;
+
+	/* the chunk on the wire ends with the length it announced */
+	if (c->cur_open) {
+		if (frame_chunk(&c->cur, c->cur_sent, &b, out, &o, max) < 0)
+			return o;
+		avail -= c->cur.len - data_sent(&c->cur, c->cur_sent);
+	}
+
+	while (avail > 0 && c->nnext < AWS_SEND_IOV) {
+		struct chunk_frame *f = &c->next[c->nnext++];
+
+		f->len = avail < c->chunk_max ? avail : c->chunk_max;
+		f->plen = sprintf(f->prefix, "%zx\r\n", f->len);
+		avail -= f->len;
+		if (frame_chunk(f, 0, &b, out, &o, max) < 0)
+			break;
+	}
+
+	return o;
+}
+
+/* Move the chunk on the wire on by up to *wire bytes; returns its data bytes */
+static size_t chunk_advance(struct chunked_encoder *c, size_t *wire)
+{
+	size_t total = c->cur.plen + c->cur.len + 2;
+	size_t take = total - c->cur_sent;
+	size_t before = data_sent(&c->cur, c->cur_sent);
+
+	if (take > *wire)
+		take = *wire;
+	c->cur_sent += take;
+	*wire -= take;
+	if (c->cur_sent == total)
+		c->cur_open = 0;
+
+	return data_sent(&c->cur, c->cur_sent) - before;
+}
+
+size_t chunked_sent(struct chunked_encoder *c, size_t wire)
+{
+	size_t data = 0;
+	int k = 0;
+
+	if (c->cur_open)
+		data += chunk_advance(c, &wire);
+
+	while (wire > 0 && k < c->nnext) {
+		c->cur = c->next[k++];
+		c->cur_sent = 0;
+		c->cur_open = 1;
+		data += chunk_advance(c, &wire);
+	}
+	c->nnext = 0;
+
+	return data;
+}
+
+int chunked_end(char *buf, size_t len, const char *trailers)
+{
+	return snprintf(buf, len, "0\r\n%s\r\n", trailers != NULL ? trailers : "");
+}
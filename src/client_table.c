@@ -0,0 +1,157 @@
+/*
+ * Asynchronous Web Server - per-client limits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/config.h"
+#include "../headers/stats.h"
+#include "../headers/client_table.h"
+
+static struct client *table;
+static uint32_t mask;
+static int shift;
+/* hash key, so colliding addresses cannot be picked in advance */
+static uint32_t seed;
+/* some limit is set, clients are worth tracking */
+static int active;
+/* ns between requests at --client-rate, and the burst it allows */
+static uint64_t interval;
+static uint64_t tolerance;
+
+static struct {
+	unsigned long long untracked;
+	unsigned long long refused_connections;
+	unsigned long long refused_requests;
+	unsigned long tracked;
+} stats;
+
+void client_table_init(void)
+{
+	unsigned int size = 1;
+
+	active = config.client_connections > 0 || config.client_rate > 0;
+	if (!active)
+		return;
+
+	shift = 32;
+	while (size < (unsigned int) config.client_table) {
+		size <<= 1;
+		shift--;
+	}
+	mask = size - 1;
+
+	table = calloc(size, sizeof(*table));
+	DIE(table == NULL, "calloc");
+
+	seed = (uint32_t) (stats_now_ns() ^ ((uint64_t) getpid() << 16)) | 1;
+
+	if (config.client_rate > 0) {
+		interval = 1000000000ULL / config.client_rate;
+		tolerance = interval * config.client_burst;
+	}
+}
+
+static uint32_t client_hash(uint32_t addr)
+{
+	/* Fibonacci hashing: the top bits of the product are the best mixed */
+	return shift < 32 ? ((addr ^ seed) * 2654435761U) >> shift : 0;
+}
+
+/* Nothing but the address left: no connection, the bucket is full */
+static int client_stale(const struct client *c, uint64_t now)
+{
+	return c->connections == 0 && c->tat <= now;
+}
+
+int client_table_connect(uint32_t addr, struct client **out)
+{
+	struct client *c = NULL, *free_slot = NULL;
+	uint32_t i, h;
+	uint64_t now;
+
+	*out = NULL;
+	if (!active)
+		return 0;
+
+	now = stats_now_ns();
+	h = client_hash(addr);
+	for (i = 0; i < AWS_CLIENT_PROBE && i <= mask; i++) {
+		struct client *slot = &table[(h + i) & mask];
+
+		if (slot->addr == addr) {
+			c = slot;
+			break;
+		}
+		if (free_slot == NULL &&
+				(slot->addr == 0 || client_stale(slot, now)))
+			free_slot = slot;
+		/* a slot never used ends every chain through it */
+		if (slot->addr == 0)
+			break;
+	}
+
+	if (c == NULL) {
+		if (free_slot == NULL) {
+			stats.untracked++;
+			return 0;
+		}
+		if (free_slot->addr == 0)
+			stats.tracked++;
+		c = free_slot;
+		c->addr = addr;
+		c->connections = 0;
+		c->tat = 0;
+	}
+
+	if (config.client_connections > 0 &&
+			c->connections >= (uint32_t) config.client_connections) {
+		stats.refused_connections++;
+		return -1;
+	}
+
+	c->connections++;
+	*out = c;
+
+	return 0;
+}
+
+void client_table_disconnect(struct client *c)
+{
+	if (c != NULL)
+		c->connections--;
+}
+
+int client_table_request(struct client *c)
+{
+	uint64_t now, tat;
+
+	if (c == NULL || interval == 0)
+		return 0;
+
+	now = stats_now_ns();
+	tat = c->tat > now ? c->tat : now;
+	if (tat + interval - now > tolerance) {
+		stats.refused_requests++;
+		return 1;
+	}
+	c->tat = tat + interval;
+
+	return 0;
+}
+
+void client_table_stats_dump(FILE *f)
+{
+	if (!active)
+		return;
+
+	fprintf(f, "clients: slots=%u used=%lu untracked=%llu "
+			"refused_connections=%llu refused_requests=%llu\n",
+			mask + 1, stats.tracked, stats.untracked,
+			stats.refused_connections, stats.refused_requests);
+}
@@ -0,0 +1,370 @@
+/*
+ * Asynchronous Web Server - runtime configuration
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <zlib.h>
+
+#include "../headers/aws.h"
+#include "../headers/config.h"
+
+struct aws_config config = {
+	.inline_max = AWS_INLINE_MAX,
+	.medium_max = AWS_MEDIUM_MAX,
+	.aio_window = AWS_AIO_WINDOW,
+	.chunk_size = AWS_CHUNK_SIZE,
+	.aio_vector = AWS_AIO_VECTOR,
+	.dynamic_engine = "aio",
+	.disk_engine = "auto",
+	.reader_threads = AWS_READER_THREADS,
+	.direct = 0,
+	.coalesce = 0,
+	.block_cache = AWS_BLOCK_CACHE,
+	.huge_pages = 0,
+	.zerocopy = 0,
+	.gzip_level = 0,
+	.gzip_cache = AWS_GZIP_CACHE,
+	.http_chunk = AWS_HTTP_CHUNK,
+	.send_quantum = AWS_SEND_QUANTUM,
+	.send_policy = "rr",
+	.rate_limit = 0,
+	.path_rates = 0,
+	.global_rate = 0,
+	.client_connections = 0,
+	.client_rate = 0,
+	.client_burst = AWS_CLIENT_BURST,
+	.client_table = AWS_CLIENT_TABLE,
+	.header_timeout = AWS_HEADER_TIMEOUT,
+	.idle_timeout = AWS_IDLE_TIMEOUT,
+	.min_rate = AWS_MIN_RATE,
+	.max_connections = 0,
+	.max_aio_bytes = 0,
+	.max_open_files = 0,
+	.overload = "pause",
+	.codel_target = 0,
+	.codel_interval = AWS_CODEL_INTERVAL,
+	.max_age = AWS_MAX_AGE,
+	.calibrate = 0,
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --inline-max=BYTES   send files up to BYTES with the header (%d)\n"
+		"  --medium-max=BYTES   upper size of the sendfile/mmap tier (%d),\n"
+		"                       dynamic files use aio instead with --direct\n"
+		"                       or reader threads\n"
+		"  --aio-window=N       AIO chunks in flight per connection (%d)\n"
+		"  --chunk-size=BYTES   size of one AIO chunk (%d)\n"
+		"  --aio-vector=N       chunks read by one preadv (%d)\n"
+		"  --dynamic-engine=E   large dynamic files use aio or splice (aio)\n"
+		"  --disk-engine=E      disk reads use aio, threads or auto (auto)\n"
+		"  --reader-threads=N   disk reader threads (%d)\n"
+		"  --direct             AIO reads use O_DIRECT and a block cache\n"
+		"  --coalesce           share buffered AIO reads between connections\n"
+		"  --block-cache=BYTES  size of the shared block cache (%d)\n"
+		"  --huge-pages         back AIO read buffers with huge pages\n"
+		"  --zerocopy           send AIO read buffers with MSG_ZEROCOPY\n"
+		"  --gzip[=LEVEL]       gzip dynamic files on the fly (level %d)\n"
+		"  --gzip-cache=BYTES   size of the compressed output cache (%d)\n"
+		"  --http-chunk=BYTES   most body bytes per chunk when chunked (%d)\n"
+		"  --send-quantum=BYTES body bytes sent per turn, 0 for no limit (%d)\n"
+		"  --send-policy=P      queued turns go rr or srf (rr)\n"
+		"  --rate-limit=BYTES   cap each connection at BYTES per second\n"
+		"  --path-rate=PFX:RATE cap the responses under a path prefix\n"
+		"  --global-rate=BYTES  cap the whole server\n"
+		"  --client-connections=N  connections per client address\n"
+		"  --client-rate=N      requests per second per client address\n"
+		"  --client-burst=N     requests a client may send at once (%d)\n"
+		"  --client-table=N     client addresses tracked at most (%d)\n"
+		"  --header-timeout=SEC seconds a client has to send a request (%d)\n"
+		"  --idle-timeout=SEC   seconds between kept-alive requests (%d)\n"
+		"  --min-rate=BYTES     bytes per second a response must move (%d)\n"
+		"  --max-connections=N  hold off new clients at N connections\n"
+		"  --max-aio-bytes=SIZE or at SIZE bytes of disk reads in flight\n"
+		"  --max-open-files=N   or at N files being served\n"
+		"  --overload=MODE      when held off: pause accepting or 503 (pause)\n"
+		"  --codel[=MS]         503 new clients waiting over MS to be served (%d)\n"
+		"  --codel-interval=MS  for at least MS (%d)\n"
+		"  --max-age=SECONDS    Cache-Control max-age of responses (%d)\n"
+		"  --calibrate          measure transfer strategies, then serve\n",
+		name, AWS_INLINE_MAX, AWS_MEDIUM_MAX, AWS_AIO_WINDOW,
+		AWS_CHUNK_SIZE, AWS_AIO_VECTOR, AWS_READER_THREADS, AWS_BLOCK_CACHE,
+		AWS_GZIP_LEVEL, AWS_GZIP_CACHE, AWS_HTTP_CHUNK, AWS_SEND_QUANTUM,
+		AWS_CLIENT_BURST, AWS_CLIENT_TABLE, AWS_HEADER_TIMEOUT,
+		AWS_IDLE_TIMEOUT, AWS_MIN_RATE, AWS_CODEL_TARGET, AWS_CODEL_INTERVAL,
+		AWS_MAX_AGE);
+}
+
+/*
+ * Parse a size with an optional k/m/g suffix.
+ */
+static size_t parse_size(const char *arg)
+{
+	char *end;
+	unsigned long long val = strtoull(arg, &end, 10);
+
+	switch (*end) {
+	case 'g': case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		val <<= 10;
+		break;
+	}
+
+	return (size_t) val;
+}
+
+/*
+ * PREFIX:RATE, the bandwidth of every response under a path prefix.
+ */
+static void parse_path_rate(char *arg)
+{
+	char *colon = strrchr(arg, ':');
+
+	if (colon == NULL || colon == arg ||
+			config.path_rates == AWS_PATH_RATES) {
+		fprintf(stderr, "bad or too many --path-rate: %s\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	*colon = '\0';
+	/* request paths are matched without their leading slashes */
+	while (*arg == '/')
+		arg++;
+	config.path_rate[config.path_rates].prefix = arg;
+	config.path_rate[config.path_rates].rate = parse_size(colon + 1);
+	if (config.path_rate[config.path_rates].rate > 0)
+		config.path_rates++;
+}
+
+void config_parse(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "inline-max",	required_argument,	NULL, 'i' },
+		{ "medium-max",	required_argument,	NULL, 'm' },
+		{ "aio-window",	required_argument,	NULL, 'w' },
+		{ "chunk-size",	required_argument,	NULL, 'k' },
+		{ "aio-vector",	required_argument,	NULL, 'v' },
+		{ "dynamic-engine", required_argument,	NULL, 'd' },
+		{ "disk-engine", required_argument,	NULL, 'e' },
+		{ "reader-threads", required_argument,	NULL, 't' },
+		{ "direct",	no_argument,		NULL, 'D' },
+		{ "coalesce",	no_argument,		NULL, 'c' },
+		{ "block-cache", required_argument,	NULL, 'b' },
+		{ "huge-pages",	no_argument,		NULL, 'H' },
+		{ "zerocopy",	no_argument,		NULL, 'Z' },
+		{ "gzip",	optional_argument,	NULL, 'g' },
+		{ "gzip-cache",	required_argument,	NULL, 'G' },
+		{ "http-chunk",	required_argument,	NULL, 'u' },
+		{ "send-quantum", required_argument,	NULL, 's' },
+		{ "send-policy", required_argument,	NULL, 'p' },
+		{ "rate-limit",	required_argument,	NULL, 'l' },
+		{ "path-rate",	required_argument,	NULL, 'P' },
+		{ "global-rate", required_argument,	NULL, 'L' },
+		{ "client-connections", required_argument, NULL, 'x' },
+		{ "client-rate", required_argument,	NULL, 'R' },
+		{ "client-burst", required_argument,	NULL, 'B' },
+		{ "client-table", required_argument,	NULL, 'E' },
+		{ "header-timeout", required_argument,	NULL, 'T' },
+		{ "idle-timeout", required_argument,	NULL, 'I' },
+		{ "min-rate",	required_argument,	NULL, 'r' },
+		{ "max-connections", required_argument, NULL, 'n' },
+		{ "max-aio-bytes", required_argument,	NULL, 'A' },
+		{ "max-open-files", required_argument,	NULL, 'f' },
+		{ "overload",	required_argument,	NULL, 'o' },
+		{ "codel",	optional_argument,	NULL, 'q' },
+		{ "codel-interval", required_argument,	NULL, 'Q' },
+		{ "max-age",	required_argument,	NULL, 'a' },
+		{ "calibrate",	no_argument,		NULL, 'C' },
+		{ "help",	no_argument,		NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+		switch (c) {
+		case 'i':
+			config.inline_max = parse_size(optarg);
+			break;
+		case 'm':
+			config.medium_max = parse_size(optarg);
+			break;
+		case 'w':
+			config.aio_window = atoi(optarg);
+			break;
+		case 'k':
+			config.chunk_size = parse_size(optarg);
+			break;
+		case 'v':
+			config.aio_vector = atoi(optarg);
+			break;
+		case 'd':
+			config.dynamic_engine = optarg;
+			break;
+		case 'e':
+			config.disk_engine = optarg;
+			break;
+		case 't':
+			config.reader_threads = atoi(optarg);
+			break;
+		case 'D':
+			config.direct = 1;
+			break;
+		case 'c':
+			config.coalesce = 1;
+			break;
+		case 'b':
+			config.block_cache = parse_size(optarg);
+			break;
+		case 'H':
+			config.huge_pages = 1;
+			break;
+		case 'Z':
+			config.zerocopy = 1;
+			break;
+		case 'g':
+			config.gzip_level = optarg != NULL ? atoi(optarg) :
+				AWS_GZIP_LEVEL;
+			break;
+		case 'G':
+			config.gzip_cache = parse_size(optarg);
+			break;
+		case 'u':
+			config.http_chunk = parse_size(optarg);
+			break;
+		case 's':
+			config.send_quantum = parse_size(optarg);
+			break;
+		case 'p':
+			config.send_policy = optarg;
+			break;
+		case 'l':
+			config.rate_limit = parse_size(optarg);
+			break;
+		case 'P':
+			parse_path_rate(optarg);
+			break;
+		case 'L':
+			config.global_rate = parse_size(optarg);
+			break;
+		case 'x':
+			config.client_connections = atoi(optarg);
+			break;
+		case 'R':
+			config.client_rate = atoi(optarg);
+			break;
+		case 'B':
+			config.client_burst = atoi(optarg);
+			break;
+		case 'E':
+			config.client_table = atoi(optarg);
+			break;
+		case 'T':
+			config.header_timeout = atoi(optarg);
+			break;
+		case 'I':
+			config.idle_timeout = atoi(optarg);
+			break;
+		case 'r':
+			config.min_rate = parse_size(optarg);
+			break;
+		case 'n':
+			config.max_connections = atoi(optarg);
+			break;
+		case 'A':
+			config.max_aio_bytes = parse_size(optarg);
+			break;
+		case 'f':
+			config.max_open_files = atoi(optarg);
+			break;
+		case 'o':
+			if (strcmp(optarg, "pause") != 0 &&
+					strcmp(optarg, "503") != 0) {
+				fprintf(stderr, "unknown overload mode: %s\n", optarg);
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			config.overload = optarg;
+			break;
+		case 'q':
+			config.codel_target = optarg != NULL ? atoi(optarg) :
+				AWS_CODEL_TARGET;
+			break;
+		case 'Q':
+			config.codel_interval = atoi(optarg);
+			break;
+		case 'a':
+			config.max_age = atoi(optarg);
+			break;
+		case 'C':
+			config.calibrate = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	/* chunks come from the I/O buffer pool: whole pages, at most 1 MiB */
+	if (config.chunk_size < AWS_IOBUF_MIN)
+		config.chunk_size = AWS_IOBUF_MIN;
+	if (config.chunk_size > AWS_IOBUF_MIN << 8)
+		config.chunk_size = AWS_IOBUF_MIN << 8;
+	config.chunk_size &= ~((size_t) AWS_IOBUF_MIN - 1);
+	if (config.aio_vector < 1)
+		config.aio_vector = 1;
+	/* the block cache hands out one block per chunk */
+	if (config.direct || config.coalesce) {
+		config.chunk_size = AWS_BLOCK_SIZE;
+		config.aio_vector = 1;
+	}
+
+	if (config.aio_window < 1)
+		config.aio_window = 1;
+	/* a small window stalls on the peer's delayed ACKs */
+	if (config.zerocopy &&
+			config.aio_window * config.chunk_size < AWS_ZEROCOPY_INFLIGHT)
+		config.aio_window = AWS_ZEROCOPY_INFLIGHT / config.chunk_size;
+	/* the window is made of whole vectors */
+	config.aio_window = (config.aio_window + config.aio_vector - 1) /
+		config.aio_vector * config.aio_vector;
+	if (config.gzip_level < 0)
+		config.gzip_level = 0;
+	if (config.gzip_level > Z_BEST_COMPRESSION)
+		config.gzip_level = Z_BEST_COMPRESSION;
+	if (config.http_chunk < 1)
+		config.http_chunk = 1;
+	if (config.header_timeout < 0)
+		config.header_timeout = 0;
+	if (config.idle_timeout < 0)
+		config.idle_timeout = 0;
+	if (config.max_connections < 0)
+		config.max_connections = 0;
+	if (config.max_open_files < 0)
+		config.max_open_files = 0;
+	if (config.client_connections < 0)
+		config.client_connections = 0;
+	if (config.client_rate < 0)
+		config.client_rate = 0;
+	if (config.client_burst < 1)
+		config.client_burst = 1;
+	if (config.client_table < AWS_CLIENT_PROBE)
+		config.client_table = AWS_CLIENT_PROBE;
+	if (config.codel_target < 0)
+		config.codel_target = 0;
+	if (config.codel_interval < 1)
+		config.codel_interval = AWS_CODEL_INTERVAL;
+	if (config.max_age < 0)
+		config.max_age = 0;
+	if (config.inline_max > AWS_INLINE_LIMIT)
+		config.inline_max = AWS_INLINE_LIMIT;
+}
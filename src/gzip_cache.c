@@ -0,0 +1,416 @@
+/*
+ * Asynchronous Web Server - on-the-fly compression of dynamic files
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/gzip_cache.h"
+
+static struct gzip_entry *hash[AWS_GZIP_BUCKETS];
+
+/* Unreferenced complete entries, most recently used first */
+static struct gzip_entry *lru_head;
+static struct gzip_entry *lru_tail;
+
+/* Entries whose next job is not queued yet, oldest first */
+static struct gzip_entry *deferred_head;
+static struct gzip_entry *deferred_tail;
+
+static size_t cache_size;
+static size_t cache_bytes;
+static int gzip_level;
+
+static struct {
+	unsigned long long hits;
+	unsigned long long joins;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long failures;
+	unsigned long long deferrals;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+} stats;
+
+static size_t entry_hash(dev_t dev, ino_t ino)
+{
+	unsigned long long h = (unsigned long long) ino * 0x9E3779B97F4A7C15ULL;
+
+	h ^= (unsigned long long) dev;
+	h ^= h >> 29;
+
+	return h & (AWS_GZIP_BUCKETS - 1);
+}
+
+static int entry_matches(const struct gzip_entry *e, const struct stat *st,
+		int encoding)
+{
+	return e->ino == st->st_ino && e->dev == st->st_dev &&
+		e->encoding == encoding && e->size == st->st_size &&
+		e->mtime.tv_sec == st->st_mtim.tv_sec &&
+		e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void lru_unlink(struct gzip_entry *e)
+{
+	if (e->lru_prev != NULL)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lru_head = e->lru_next;
+	if (e->lru_next != NULL)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push(struct gzip_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+}
+
+static void hash_unlink(struct gzip_entry *e)
+{
+	struct gzip_entry **p = &hash[entry_hash(e->dev, e->ino)];
+
+	while (*p != NULL && *p != e)
+		p = &(*p)->hnext;
+	if (*p != NULL)
+		*p = e->hnext;
+	e->hnext = NULL;
+}
+
+static void entry_free(struct gzip_entry *e)
+{
+	struct gzip_segment *s = e->head;
+
+	while (s != NULL) {
+		struct gzip_segment *next = s->next;
+
+		free(s);
+		s = next;
+	}
+	cache_bytes -= e->bytes;
+	free(e);
+}
+
+/* Drop idle entries until the cache fits its size again */
+static void cache_trim(void)
+{
+	while (cache_bytes > cache_size && lru_tail != NULL) {
+		struct gzip_entry *e = lru_tail;
+
+		lru_unlink(e);
+		hash_unlink(e);
+		entry_free(e);
+		stats.evictions++;
+	}
+}
+
+/* Keep len bytes of output and give back the spare room */
+static struct gzip_segment *segment_close(struct gzip_segment *s, size_t len)
+{
+	struct gzip_segment *t;
+
+	s->next = NULL;
+	s->len = len;
+
+	t = realloc(s, sizeof(*s) + len);
+
+	return t != NULL ? t : s;
+}
+
+/*
+ * Reader thread: compress the next input chunk of the file into e->fresh.
+ * res is 1 once the stream is finished, 0 if input is left, -errno on
+ * failure.
+ */
+static void gzip_run(struct pool_job *job)
+{
+	struct gzip_entry *e = (struct gzip_entry *)
+		((char *) job - offsetof(struct gzip_entry, job));
+	struct gzip_segment *s, **tail = &e->fresh;
+	size_t len, cap;
+	ssize_t n;
+	int flush, rc;
+
+	e->fresh = NULL;
+	job->res = -ENOMEM;
+
+	if (!e->zs_ready) {
+		e->in = malloc(AWS_GZIP_CHUNK);
+		if (e->in == NULL)
+			return;
+		/* 16 + window bits: gzip header and trailer around the stream */
+		memset(&e->zs, 0, sizeof(e->zs));
+		if (deflateInit2(&e->zs, gzip_level, Z_DEFLATED, 16 + MAX_WBITS,
+				8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return;
+		e->zs_ready = 1;
+	}
+
+	/* the file is compressed as fstat() saw it, whatever it grew to */
+	len = e->size - e->in_pos > AWS_GZIP_CHUNK ?
+		AWS_GZIP_CHUNK : e->size - e->in_pos;
+	n = len > 0 ? pread(e->fd, e->in, len, e->in_pos) : 0;
+	if (n < 0) {
+		job->res = -errno;
+		return;
+	}
+	e->in_pos += n;
+	flush = n == 0 || e->in_pos >= e->size ? Z_FINISH : Z_NO_FLUSH;
+
+	e->zs.next_in = (Bytef *) e->in;
+	e->zs.avail_in = n;
+	cap = deflateBound(&e->zs, n);
+
+	/* deflate may hold on to earlier input; take whatever it gives */
+	do {
+		s = malloc(sizeof(*s) + cap);
+		if (s == NULL)
+			return;
+		e->zs.next_out = (Bytef *) s->data;
+		e->zs.avail_out = cap;
+		rc = deflate(&e->zs, flush);
+		if (rc == Z_STREAM_ERROR) {
+			free(s);
+			job->res = -EIO;
+			return;
+		}
+
+		len = cap - e->zs.avail_out;
+		if (len == 0) {
+			free(s);
+			break;
+		}
+		*tail = segment_close(s, len);
+		tail = &(*tail)->next;
+	} while (e->zs.avail_out == 0);
+
+	if (flush != Z_FINISH) {
+		job->res = 0;
+		return;
+	}
+	job->res = rc == Z_STREAM_END ? 1 : -EIO;
+}
+
+static void stream_end(struct gzip_entry *e)
+{
+	if (e->zs_ready)
+		deflateEnd(&e->zs);
+	e->zs_ready = 0;
+	free(e->in);
+	e->in = NULL;
+	close(e->fd);
+	e->fd = -1;
+}
+
+/*
+ * Append the output of the job that just ran and tell the waiters.
+ * Returns non-zero while the file has more input to compress.
+ */
+static int entry_publish(struct gzip_entry *e)
+{
+	struct gzip_segment *s;
+	struct gzip_waiter *w;
+	int running;
+
+	if (e->fresh != NULL) {
+		if (e->tail != NULL)
+			e->tail->next = e->fresh;
+		else
+			e->head = e->fresh;
+		for (s = e->fresh; s != NULL; s = s->next) {
+			e->bytes += sizeof(*s) + s->len;
+			cache_bytes += sizeof(*s) + s->len;
+			stats.bytes_out += s->len;
+			e->tail = s;
+		}
+		e->fresh = NULL;
+	}
+
+	if (e->job.res < 0) {
+		e->state = GZIP_FAILED;
+		stats.failures++;
+		/* the next request for the file starts over */
+		hash_unlink(e);
+	} else if (e->job.res > 0) {
+		e->state = GZIP_DONE;
+		stats.bytes_in += e->in_pos;
+	}
+	running = e->state == GZIP_RUNNING;
+
+	w = e->waiters;
+	e->waiters = NULL;
+	while (w != NULL) {
+		struct gzip_waiter *next = w->next;
+
+		w->queued = 0;
+		w->ready(w);
+		w = next;
+	}
+
+	if (!running) {
+		stream_end(e);
+		/* the reference of the compressor */
+		gzip_cache_put(e);
+	}
+	cache_trim();
+
+	return running;
+}
+
+/*
+ * Queue the next chunk of e on a reader thread. Should every ring be
+ * full, e waits behind the entries already deferred; the jobs in the
+ * rings complete and make room.
+ */
+static void entry_compress(struct gzip_entry *e)
+{
+	if (deferred_head == NULL && reader_pool_submit(&e->job) == 0)
+		return;
+
+	e->deferred = NULL;
+	if (deferred_tail != NULL)
+		deferred_tail->deferred = e;
+	else
+		deferred_head = e;
+	deferred_tail = e;
+	stats.deferrals++;
+}
+
+static void gzip_job_done(struct pool_job *job)
+{
+	struct gzip_entry *e = (struct gzip_entry *)
+		((char *) job - offsetof(struct gzip_entry, job));
+
+	/* the ring slot it had is free: older deferred jobs go first */
+	gzip_cache_resubmit();
+	if (entry_publish(e))
+		entry_compress(e);
+}
+
+void gzip_cache_resubmit(void)
+{
+	while (deferred_head != NULL &&
+			reader_pool_submit(&deferred_head->job) == 0) {
+		deferred_head = deferred_head->deferred;
+		if (deferred_head == NULL)
+			deferred_tail = NULL;
+	}
+}
+
+void gzip_cache_init(size_t bytes, int level)
+{
+	cache_size = bytes;
+	gzip_level = level;
+}
+
+struct gzip_entry *gzip_cache_get(int fd, const struct stat *st, int encoding)
+{
+	size_t h = entry_hash(st->st_dev, st->st_ino);
+	struct gzip_entry *e;
+
+	for (e = hash[h]; e != NULL; e = e->hnext)
+		if (entry_matches(e, st, encoding))
+			break;
+
+	if (e != NULL) {
+		if (e->refs++ == 0)
+			lru_unlink(e);
+		if (e->state == GZIP_DONE)
+			stats.hits++;
+		else
+			stats.joins++;
+		return e;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+
+	/* the compressor may outlive the response that started it */
+	e->fd = dup(fd);
+	if (e->fd < 0) {
+		free(e);
+		return NULL;
+	}
+	stats.misses++;
+
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = st->st_mtim;
+	e->encoding = encoding;
+	e->state = GZIP_RUNNING;
+	/* the caller's and the compressor's */
+	e->refs = 2;
+	e->job.op = POOL_CALL;
+	e->job.run = gzip_run;
+	e->job.complete = gzip_job_done;
+	e->hnext = hash[h];
+	hash[h] = e;
+
+	entry_compress(e);
+
+	return e;
+}
+
+void gzip_cache_put(struct gzip_entry *e)
+{
+	if (--e->refs > 0)
+		return;
+
+	/* failed and oversized entries are of no use to the next request */
+	if (e->state != GZIP_DONE || e->bytes > cache_size) {
+		if (e->state == GZIP_DONE)
+			hash_unlink(e);
+		entry_free(e);
+		return;
+	}
+
+	lru_push(e);
+	cache_trim();
+}
+
+int gzip_cache_wait(struct gzip_entry *e, struct gzip_waiter *w)
+{
+	if (w->queued)
+		return 0;
+
+	w->queued = 1;
+	w->next = e->waiters;
+	e->waiters = w;
+
+	return 1;
+}
+
+void gzip_cache_stats_dump(FILE *f)
+{
+	if (gzip_level == 0)
+		return;
+
+	fprintf(f, "gzip: level=%d hits=%llu joins=%llu misses=%llu "
+			"evictions=%llu failures=%llu deferrals=%llu cached=%zu\n",
+			gzip_level, stats.hits, stats.joins, stats.misses,
+			stats.evictions, stats.failures, stats.deferrals,
+			cache_bytes);
+	fprintf(f, "gzip: in=%llu out=%llu ratio=%.2f\n",
+			stats.bytes_in, stats.bytes_out,
+			stats.bytes_out ? (double) stats.bytes_in / stats.bytes_out : 0.0);
+}
@@ -0,0 +1,133 @@
+/*
+ * Asynchronous Web Server - pool of aligned I/O buffers
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/io_buffer.h"
+
+/* Size classes: AWS_IOBUF_MIN << 0 .. AWS_IOBUF_MIN << (IOBUF_CLASSES - 1) */
+#define IOBUF_CLASSES	9
+
+struct iobuf_class {
+	size_t size;
+	void *free;
+	size_t in_use;
+	size_t high_water;
+	size_t total;
+};
+
+static struct iobuf_class classes[IOBUF_CLASSES];
+static int use_huge_pages;
+static size_t arenas;
+static size_t huge_arenas;
+
+static int iobuf_class(size_t size)
+{
+	int i;
+
+	for (i = 0; i < IOBUF_CLASSES; i++)
+		if (size <= classes[i].size)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Map one arena and split it into buffers of class c.
+ */
+static int iobuf_grow(struct iobuf_class *c)
+{
+	size_t len = AWS_IOBUF_ARENA, i;
+	char *mem = MAP_FAILED;
+
+	if (use_huge_pages) {
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem != MAP_FAILED) {
+			huge_arenas++;
+		} else {
+			fprintf(stderr, "no huge pages, using regular pages\n");
+			use_huge_pages = 0;
+		}
+	}
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			ERR("mmap");
+			return -1;
+		}
+	}
+	arenas++;
+
+	for (i = len / c->size; i > 0; i--) {
+		void **buf = (void **) (mem + (i - 1) * c->size);
+
+		*buf = c->free;
+		c->free = buf;
+	}
+	c->total += len / c->size;
+
+	return 0;
+}
+
+void io_buffer_init(int huge_pages)
+{
+	int i;
+
+	for (i = 0; i < IOBUF_CLASSES; i++)
+		classes[i].size = (size_t) AWS_IOBUF_MIN << i;
+	use_huge_pages = huge_pages;
+}
+
+void *io_buffer_get(size_t size)
+{
+	struct iobuf_class *c;
+	void **buf;
+	int i = iobuf_class(size);
+
+	if (i < 0)
+		return NULL;
+
+	c = &classes[i];
+	if (c->free == NULL && iobuf_grow(c) < 0)
+		return NULL;
+
+	buf = c->free;
+	c->free = *buf;
+	if (++c->in_use > c->high_water)
+		c->high_water = c->in_use;
+
+	return buf;
+}
+
+void io_buffer_put(void *buf, size_t size)
+{
+	struct iobuf_class *c = &classes[iobuf_class(size)];
+
+	*(void **) buf = c->free;
+	c->free = buf;
+	c->in_use--;
+}
+
+void io_buffer_stats_dump(FILE *f)
+{
+	int i;
+
+	fprintf(f, "io buffers: arenas=%zu huge=%zu reserved=%zu\n", arenas,
+			huge_arenas, arenas * (size_t) AWS_IOBUF_ARENA);
+	for (i = 0; i < IOBUF_CLASSES; i++) {
+		if (classes[i].total == 0)
+			continue;
+		fprintf(f, "io buffers %zu: in_use=%zu high_water=%zu total=%zu\n",
+				classes[i].size, classes[i].in_use,
+				classes[i].high_water, classes[i].total);
+	}
+}
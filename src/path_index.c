@@ -0,0 +1,219 @@
+/*
+ * Asynchronous Web Server - index of precompressed static files
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/path_index.h"
+
+const char *const encoding_names[ENCODINGS] = {
+	[ENCODING_IDENTITY] = "identity",
+	[ENCODING_GZIP] = "gzip",
+	[ENCODING_BR] = "br",
+};
+
+static const char *const encoding_suffixes[ENCODINGS] = {
+	[ENCODING_GZIP] = ".gz",
+	[ENCODING_BR] = ".br",
+};
+
+static struct path_entry *entries;
+static size_t entries_mask;
+
+static uint64_t path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*path != '\0')
+		h = (h ^ (unsigned char) *path++) * 0x100000001b3ULL;
+
+	return h;
+}
+
+void path_index_init(size_t n)
+{
+	size_t size = 1, i;
+	int e;
+
+	while (size < n)
+		size <<= 1;
+
+	entries = calloc(size, sizeof(*entries));
+	DIE(entries == NULL, "calloc");
+	entries_mask = size - 1;
+
+	for (i = 0; i < size; i++)
+		for (e = 0; e < ENCODINGS; e++)
+			entries[i].fd[e] = -1;
+}
+
+static int entry_matches(const struct path_entry *p, uint64_t hash,
+		const struct stat *st)
+{
+	return p->hash == hash && p->dev == st->st_dev && p->ino == st->st_ino &&
+		p->size == st->st_size &&
+		p->mtime.tv_sec == st->st_mtim.tv_sec &&
+		p->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void entry_clear(struct path_entry *p)
+{
+	int e;
+
+	for (e = 0; e < ENCODINGS; e++) {
+		if (p->fd[e] >= 0)
+			close(p->fd[e]);
+		p->fd[e] = -1;
+	}
+	p->variants = 0;
+}
+
+/* Open the sidecars of path; only regular files at least as new count */
+static void entry_load(struct path_entry *p, const char *path,
+		const struct stat *st, uint64_t hash)
+{
+	char sidecar[BUFSIZ];
+	int e, fd;
+
+	entry_clear(p);
+	p->hash = hash;
+	p->dev = st->st_dev;
+	p->ino = st->st_ino;
+	p->size = st->st_size;
+	p->mtime = st->st_mtim;
+	p->loaded = time(NULL);
+	p->st[ENCODING_IDENTITY] = *st;
+
+	for (e = ENCODING_IDENTITY + 1; e < ENCODINGS; e++) {
+		if (snprintf(sidecar, sizeof(sidecar), "%s%s", path,
+				encoding_suffixes[e]) >= (int) sizeof(sidecar))
+			continue;
+
+		fd = open(sidecar, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (fstat(fd, &p->st[e]) < 0 || !S_ISREG(p->st[e].st_mode) ||
+				p->st[e].st_mtim.tv_sec < st->st_mtim.tv_sec) {
+			close(fd);
+			continue;
+		}
+		p->fd[e] = fd;
+		p->variants |= 1U << e;
+	}
+}
+
+struct path_entry *path_index_get(const char *path, const struct stat *st)
+{
+	uint64_t hash = path_hash(path);
+	struct path_entry *p = &entries[hash & entries_mask];
+
+	/* Sidecars still being sent from are neither closed nor replaced */
+	if (!entry_matches(p, hash, st)) {
+		if (p->refs > 0)
+			return NULL;
+		entry_load(p, path, st, hash);
+	} else if (p->refs == 0 && time(NULL) - p->loaded >= AWS_PATH_INDEX_TTL) {
+		entry_load(p, path, st, hash);
+	}
+
+	p->refs++;
+
+	return p;
+}
+
+int path_index_lookup(const char *path, struct stat *st)
+{
+	uint64_t hash = path_hash(path);
+	const struct path_entry *p = &entries[hash & entries_mask];
+
+	if (p->loaded == 0 || p->hash != hash ||
+			time(NULL) - p->loaded >= AWS_PATH_INDEX_TTL)
+		return -1;
+
+	*st = p->st[ENCODING_IDENTITY];
+
+	return 0;
+}
+
+void path_index_put(struct path_entry *e)
+{
+	e->refs--;
+}
+
+/* q-value in thousandths; 1000 when absent */
+static int parse_qvalue(const char *p, const char *end)
+{
+	int q = 0, scale = 100;
+
+	while (p < end && (p = memchr(p, ';', end - p)) != NULL) {
+		p += 1 + strspn(p + 1, " \t");
+		if (end - p < 2 || (*p != 'q' && *p != 'Q') || p[1] != '=')
+			continue;
+		p += 2;
+		if (p < end && *p == '1')
+			return 1000;
+		if (p < end && *p == '0')
+			p++;
+		if (p < end && *p == '.')
+			p++;
+		for (; p < end && *p >= '0' && *p <= '9' && scale > 0; p++) {
+			q += (*p - '0') * scale;
+			scale /= 10;
+		}
+		return q;
+	}
+
+	return 1000;
+}
+
+enum content_encoding encoding_negotiate(const char *accept,
+		unsigned int variants)
+{
+	int q[ENCODINGS], any = -1, best = ENCODING_IDENTITY, best_q = 0;
+	const char *p = accept, *end;
+	size_t len;
+	int e;
+
+	if (accept == NULL || variants == 0)
+		return ENCODING_IDENTITY;
+
+	for (e = 0; e < ENCODINGS; e++)
+		q[e] = -1;
+
+	while (*p != '\0') {
+		p += strspn(p, " \t,");
+		end = p + strcspn(p, ",");
+		len = strcspn(p, " \t;,");
+
+		if (len == 1 && *p == '*')
+			any = parse_qvalue(p, end);
+		for (e = ENCODING_IDENTITY + 1; e < ENCODINGS; e++)
+			if (len == strlen(encoding_names[e]) &&
+					strncasecmp(p, encoding_names[e], len) == 0)
+				q[e] = parse_qvalue(p, end);
+		/* old name of gzip */
+		if (len == 6 && strncasecmp(p, "x-gzip", len) == 0)
+			q[ENCODING_GZIP] = parse_qvalue(p, end);
+
+		p = end;
+	}
+
+	/* later codings win ties, they compress better */
+	for (e = ENCODING_IDENTITY + 1; e < ENCODINGS; e++) {
+		int qe = q[e] >= 0 ? q[e] : any;
+
+		if ((variants & (1U << e)) && qe > 0 && qe >= best_q) {
+			best = e;
+			best_q = qe;
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,143 @@
+/*
+ * Asynchronous Web Server - HTTP byte ranges
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../headers/aws.h"
+#include "../headers/range.h"
+
+#define OFF_MAX		((off_t) (~0ULL >> 1))
+
+static const char *skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	return p;
+}
+
+/* Returns 0 when there is no offset at p or it does not fit an off_t */
+static int parse_offset(const char **p, off_t *val)
+{
+	const char *s = *p;
+	off_t v = 0;
+
+	if (*s < '0' || *s > '9')
+		return 0;
+
+	for (; *s >= '0' && *s <= '9'; s++) {
+		if (v > (OFF_MAX - (*s - '0')) / 10)
+			return 0;
+		v = v * 10 + (*s - '0');
+	}
+
+	*p = s;
+	*val = v;
+
+	return 1;
+}
+
+int range_parse(const char *spec, off_t size, struct byte_range *r, int max)
+{
+	const char *p = skip_space(spec);
+	off_t first, last;
+	int n = 0, seen = 0;
+
+	if (strncasecmp(p, "bytes", 5) != 0)
+		return 0;
+	p = skip_space(p + 5);
+	if (*p++ != '=')
+		return 0;
+
+	while (*(p = skip_space(p)) != '\0') {
+		/* empty list elements are allowed */
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+
+		if (*p == '-') {
+			/* suffix: the last bytes of the file */
+			p++;
+			if (!parse_offset(&p, &last))
+				return 0;
+			first = last < size ? size - last : 0;
+			last = size - 1;
+		} else {
+			if (!parse_offset(&p, &first) || *p++ != '-')
+				return 0;
+			if (!parse_offset(&p, &last))
+				last = size - 1;
+			else if (last < first)
+				return 0;
+			if (last >= size)
+				last = size - 1;
+		}
+
+		p = skip_space(p);
+		if (*p != ',' && *p != '\0')
+			return 0;
+		seen++;
+
+		/* unsatisfiable ranges are dropped, the others served */
+		if (first >= size)
+			continue;
+		if (n == max)
+			return 0;
+		r[n].start = first;
+		r[n].end = last + 1;
+		n++;
+	}
+
+	if (seen == 0)
+		return 0;
+
+	return n > 0 ? n : -1;
+}
+
+void range_boundary(const struct stat *st, char *buf)
+{
+	unsigned long long h = (unsigned long long) st->st_ino * 0x9E3779B97F4A7C15ULL;
+
+	h ^= (unsigned long long) st->st_mtim.tv_sec ^
+		(unsigned long long) st->st_mtim.tv_nsec << 32 ^ st->st_size;
+	snprintf(buf, AWS_BOUNDARY_LEN + 1, "aws-%016llx", h);
+}
+
+int range_part_header(char *buf, size_t len, const struct stat *st,
+		const char *type, const struct byte_range *r)
+{
+	char boundary[AWS_BOUNDARY_LEN + 1];
+
+	range_boundary(st, boundary);
+
+	return snprintf(buf, len, "\r\n--%s\r\nContent-Type: %s\r\n"
+			"Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+			boundary, type, (long long) r->start,
+			(long long) r->end - 1, (long long) st->st_size);
+}
+
+int range_closing(char *buf, size_t len, const struct stat *st)
+{
+	char boundary[AWS_BOUNDARY_LEN + 1];
+
+	range_boundary(st, boundary);
+
+	return snprintf(buf, len, "\r\n--%s--\r\n", boundary);
+}
+
+off_t range_multipart_length(const struct stat *st, const char *type,
+		const struct byte_range *r, int n)
+{
+	off_t len = range_closing(NULL, 0, st);
+	int i;
+
+	for (i = 0; i < n; i++)
+		len += range_part_header(NULL, 0, st, type, &r[i]) +
+			r[i].end - r[i].start;
+
+	return len;
+}
@@ -0,0 +1,214 @@
+/*
+ * Asynchronous Web Server - disk reader threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/reader_pool.h"
+
+/* Single producer (event loop), single consumer (one worker) */
+struct spsc_ring {
+	_Atomic unsigned int head;
+	_Atomic unsigned int tail;
+	struct pool_job *slot[AWS_POOL_RING];
+	sem_t items;
+	pthread_t thread;
+};
+
+static struct spsc_ring *rings;
+static int nthreads;
+static int next_ring;
+static int started;
+/* reads and opens go through the workers, not just POOL_CALL jobs */
+static int active;
+static int notify;
+
+/* Finished jobs, pushed by any worker and popped by the event loop */
+static _Atomic(struct pool_job *) done;
+
+static void run_job(struct pool_job *job)
+{
+	int fd;
+
+	switch (job->op) {
+	case POOL_READ:
+		job->res = pread(job->fd, job->buf, job->len, job->offset);
+		if (job->res < 0)
+			job->res = -errno;
+		break;
+	case POOL_READV:
+		job->res = preadv(job->fd, job->iov, job->iovcnt, job->offset);
+		if (job->res < 0)
+			job->res = -errno;
+		break;
+	case POOL_OPEN:
+		fd = open(job->path, O_RDONLY);
+		if (fd >= 0 && fstat(fd, job->st) < 0) {
+			job->res = -errno;
+			close(fd);
+		} else {
+			job->res = fd < 0 ? -errno : fd;
+		}
+		break;
+	case POOL_STAT:
+		job->res = stat(job->path, job->st) < 0 ? -errno : 0;
+		break;
+	case POOL_CALL:
+		job->run(job);
+		break;
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct spsc_ring *r = arg;
+	uint64_t one = 1;
+
+	while (1) {
+		struct pool_job *job, *old;
+		unsigned int h;
+
+		while (sem_wait(&r->items) < 0)
+			;
+
+		h = atomic_load_explicit(&r->head, memory_order_relaxed);
+		job = r->slot[h % AWS_POOL_RING];
+		atomic_store_explicit(&r->head, h + 1, memory_order_release);
+
+		run_job(job);
+
+		old = atomic_load_explicit(&done, memory_order_relaxed);
+		do {
+			job->next = old;
+		} while (!atomic_compare_exchange_weak_explicit(&done, &old, job,
+					memory_order_release, memory_order_relaxed));
+
+		if (write(notify, &one, sizeof(one)) < 0)
+			ERR("write eventfd");
+	}
+
+	return NULL;
+}
+
+/*
+ * Set up (but do not start) threads workers; completions are signalled
+ * on notify_fd.
+ */
+void reader_pool_init(int threads, int notify_fd)
+{
+	nthreads = threads > 0 ? threads : 1;
+	notify = notify_fd;
+}
+
+/*
+ * Start the workers for POOL_CALL jobs; disk reads are left alone.
+ */
+int reader_pool_spawn(void)
+{
+	int i, rc;
+
+	if (started)
+		return 0;
+
+	rings = calloc(nthreads, sizeof(*rings));
+	DIE(rings == NULL, "calloc");
+
+	for (i = 0; i < nthreads; i++) {
+		rc = sem_init(&rings[i].items, 0, 0);
+		DIE(rc < 0, "sem_init");
+		rc = pthread_create(&rings[i].thread, NULL, worker, &rings[i]);
+		if (rc != 0) {
+			errno = rc;
+			ERR("pthread_create");
+			nthreads = i;
+			break;
+		}
+	}
+
+	started = nthreads > 0;
+	fprintf(stderr, "reader pool: %d threads\n", nthreads);
+
+	return started ? 0 : -1;
+}
+
+/*
+ * Start the workers; from now on reads and opens go through the pool.
+ */
+int reader_pool_start(void)
+{
+	if (reader_pool_spawn() < 0)
+		return -1;
+	active = 1;
+
+	return 0;
+}
+
+int reader_pool_active(void)
+{
+	return active;
+}
+
+/*
+ * Hand job to the next worker with room; -1 if every ring is full.
+ */
+int reader_pool_submit(struct pool_job *job)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		struct spsc_ring *r = &rings[next_ring];
+		unsigned int t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+		unsigned int h = atomic_load_explicit(&r->head, memory_order_acquire);
+
+		next_ring = (next_ring + 1) % nthreads;
+		if (t - h >= AWS_POOL_RING)
+			continue;
+
+		r->slot[t % AWS_POOL_RING] = job;
+		atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+		sem_post(&r->items);
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Run completion callbacks of finished jobs, oldest first.
+ */
+void reader_pool_complete(void)
+{
+	struct pool_job *list, *fifo = NULL;
+
+	if (!started)
+		return;
+
+	list = atomic_exchange_explicit(&done, NULL, memory_order_acquire);
+	while (list != NULL) {
+		struct pool_job *next = list->next;
+
+		list->next = fifo;
+		fifo = list;
+		list = next;
+	}
+
+	while (fifo != NULL) {
+		struct pool_job *next = fifo->next;
+
+		fifo->complete(fifo);
+		fifo = next;
+	}
+}
@@ -0,0 +1,98 @@
+/*
+ * Asynchronous Web Server - send scheduling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../headers/config.h"
+#include "../headers/send_sched.h"
+
+/* a FIFO per class, circular around its head; bit n of busy: class n queued */
+static struct sched_link classes[SCHED_CLASSES];
+static uint64_t busy;
+static int srf;
+
+static struct {
+	unsigned long long yields;
+	unsigned long long turns;
+	unsigned long queued;
+	unsigned long max_queued;
+} stats;
+
+void send_sched_init(void)
+{
+	int i;
+
+	if (strcmp(config.send_policy, "srf") == 0) {
+		srf = 1;
+	} else if (strcmp(config.send_policy, "rr") != 0) {
+		fprintf(stderr, "unknown send policy: %s\n", config.send_policy);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < SCHED_CLASSES; i++)
+		classes[i].next = classes[i].prev = &classes[i];
+}
+
+void send_sched_push(struct sched_link *l, uint64_t remaining)
+{
+	struct sched_link *head;
+
+	if (sched_queued(l))
+		send_sched_remove(l);
+
+	l->class = srf ? 63 - __builtin_clzll(remaining | 1) : 0;
+	head = &classes[l->class];
+	l->next = head;
+	l->prev = head->prev;
+	head->prev->next = l;
+	head->prev = l;
+	busy |= 1ULL << l->class;
+
+	stats.yields++;
+	if (++stats.queued > stats.max_queued)
+		stats.max_queued = stats.queued;
+}
+
+void send_sched_remove(struct sched_link *l)
+{
+	if (!sched_queued(l))
+		return;
+
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+	if (classes[l->class].next == &classes[l->class])
+		busy &= ~(1ULL << l->class);
+	sched_link_init(l);
+	stats.queued--;
+}
+
+struct sched_link *send_sched_pop(void)
+{
+	struct sched_link *l;
+
+	if (busy == 0)
+		return NULL;
+
+	l = classes[__builtin_ctzll(busy)].next;
+	send_sched_remove(l);
+	stats.turns++;
+
+	return l;
+}
+
+int send_sched_empty(void)
+{
+	return busy == 0;
+}
+
+void send_sched_stats_dump(FILE *f)
+{
+	fprintf(f, "send_sched: policy=%s quantum=%zu yields=%llu turns=%llu "
+			"queued=%lu max_queued=%lu\n",
+			srf ? "srf" : "rr", config.send_quantum, stats.yields,
+			stats.turns, stats.queued, stats.max_queued);
+}
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -15,21 +16,36 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/sendfile.h>
-#include <libaio.h>
-#include <sys/eventfd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/resource.h>
 
 #include "../headers/util.h"
 #include "../headers/debug.h"
 #include "../headers/sock_util.h"
 #include "../headers/w_epoll.h"
 #include "../headers/aws.h"
+#include "../headers/config.h"
+#include "../headers/connection.h"
+#include "../headers/transfer.h"
+#include "../headers/slab.h"
+#include "../headers/range.h"
+#include "../headers/validator.h"
+#include "../headers/path_index.h"
+#include "../headers/timer_wheel.h"
+#include "../headers/send_sched.h"
+#include "../headers/shaper.h"
+#include "../headers/client_table.h"
+#include "../headers/admission.h"
+#include "../headers/alloc_phase.h"
 
 #include "http-parser/http_parser.h"
 
 #define STATIC "static"
-#define NUM_OPS 10
 
 /* Parser used for requests */
 static http_parser request_parser;
@@ -37,45 +53,79 @@ static http_parser request_parser;
 /* Storage for request_path */
 static char request_path[BUFSIZ];
 
+/* Names of the request headers kept for the response (see connection.h) */
+static const char *const request_header_names[REQUEST_HEADERS] = {
+	[HEADER_RANGE] = "Range",
+	[HEADER_IF_RANGE] = "If-Range",
+	[HEADER_IF_NONE_MATCH] = "If-None-Match",
+	[HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+	[HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+	[HEADER_TE] = "TE",
+};
+
+/* Values of the headers above, pointing into recv_buffer */
+static struct {
+	const char *value;
+	size_t len;
+} request_headers[REQUEST_HEADERS];
+
+/* Header whose value the parser reports next, REQUEST_HEADERS for none */
+static int request_header;
+
 /* Server socket file descriptor */
 static int listenfd;
 
 /* Epoll file descriptor */
 static int epollfd;
 
-enum connection_state {
-	STATE_DATA_RECEIVED,
-	STATE_DATA_SENT,
-	STATE_CONNECTION_CLOSED
-};
+/* Eventfd signalling finished asynchronous reads */
+static int eefd;
+
+/* Timerfd turning the timeout wheel */
+static int timerfd;
 
-/* Structure acting as a connection handler */
-struct connection {
-	int sockfd;
-
-	/* File information variables */
-	int fd;
-	char pathname[BUFSIZ];
-
-	/* Buffers used for receiving messages and then echoing them back */
-	char recv_buffer[BUFSIZ];
-	size_t recv_len;
-	char send_buffer[BUFSIZ];
-	size_t send_len;
-	enum connection_state state;
-
-	/* Variables used for dynamic files */
-	struct iocb *iocb_read;
-	struct iocb **piocb_read;
-	struct iocb *iocb_write;
-	struct iocb **piocb_write;
-	struct stat *buf;
-	char **buffer;
-	int iocbs;
-	int efd;
+/* Connections dropped by each kind of timeout */
+static const char *const timeout_names[TIMEOUTS] = {
+	[TIMEOUT_HEADER] = "header",
+	[TIMEOUT_IDLE] = "idle",
+	[TIMEOUT_RATE] = "rate",
 };
+static unsigned long long timeouts[TIMEOUTS];
+
+/* What admission control weighs (see admission.h) */
+static struct admission_load load;
+/* new connections are held off, and accept() ran out of descriptors */
+static int overloaded;
+static int accept_failed;
+/* listenfd is in the epoll set */
+static int listening;
+
+/* Canned answer to clients accepted while overloaded (--overload=503) */
+static const char overload_response[] =
+	"HTTP/1.0 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Length: 0\r\n\r\n";
+
+/* Canned answer to a request header cut short by --header-timeout */
+static const char timeout_response[] =
+	"HTTP/1.0 408 Request Timeout\r\n"
+	"Content-Length: 0\r\n\r\n";
+
+/* Set by SIGUSR1, statistics are dumped from the main loop */
+static volatile sig_atomic_t dump_requested;
+
+/* Heap call counters, linked in by the aws-alloc build only */
+void alloc_stats_dump(FILE *f) __attribute__((weak));
+
+/* Request phase heap calls are charged to */
+enum alloc_phase alloc_phase;
 
-int eefd;
+/* Connection objects, recycled without going through malloc() */
+static struct slab_cache connection_cache;
+
+/* Buffers lent to connections while they read a request or send a response */
+static struct slab_cache recv_buffer_cache;
+static struct slab_cache send_buffer_cache;
 
 /*
  * Callback is invoked by HTTP request parser when parsing request path.
@@ -89,18 +139,39 @@ static int on_path_cb(http_parser *p, const char *buf, size_t len)
 	return 0;
 }
 
-/* Use mostly null settings except for on_path callback. */
+static int on_header_field_cb(http_parser *p, const char *buf, size_t len)
+{
+	int i;
+
+	assert(p == &request_parser);
+	request_header = REQUEST_HEADERS;
+	for (i = 0; i < REQUEST_HEADERS; i++)
+		if (strlen(request_header_names[i]) == len &&
+				strncasecmp(buf, request_header_names[i], len) == 0)
+			request_header = i;
+
+	return 0;
+}
+
+static int on_header_value_cb(http_parser *p, const char *buf, size_t len)
+{
+	assert(p == &request_parser);
+	if (request_header < REQUEST_HEADERS) {
+		request_headers[request_header].value = buf;
+		request_headers[request_header].len = len;
+	}
+
+	return 0;
+}
+
+/*
+ * The request target goes to on_path_cb (query strings included, as
+ * always) and the headers listed in request_header_names are kept.
+ */
 static http_parser_settings settings_on_path = {
-	/* on_message_begin */ 0,
-	/* on_header_field */ 0,
-	/* on_header_value */ 0,
-	/* on_path */ on_path_cb,
-	/* on_url */ 0,
-	/* on_fragment */ 0,
-	/* on_query_string */ 0,
-	/* on_body */ 0,
-	/* on_headers_complete */ 0,
-	/* on_message_complete */ 0
+	.on_url = on_path_cb,
+	.on_header_field = on_header_field_cb,
+	.on_header_value = on_header_value_cb,
 };
 
 /*
@@ -108,27 +179,316 @@ static http_parser_settings settings_on_path = {
  */
 static struct connection *connection_create(int sockfd)
 {
-	struct connection *conn = malloc(sizeof(*conn));
-	DIE(conn == NULL, "malloc");
+	struct connection *conn = slab_alloc(&connection_cache);
+	DIE(conn == NULL, "slab_alloc");
 
+	/* The cold part is written before it is read, leave its pages alone */
+	memset(conn, 0, CONNECTION_HOT_SIZE);
+	load.connections++;
 	conn->sockfd = sockfd;
-	memset(conn->recv_buffer, 0, BUFSIZ);
-	memset(conn->send_buffer, 0, BUFSIZ);
+	conn->fd = -1;
+	conn->engine = -1;
+	conn->state = STATE_INITIAL;
 
 	return conn;
 }
 
+static void recv_buffer_put(struct connection *conn)
+{
+	if (conn->recv_buffer == NULL)
+		return;
+
+	slab_free(&recv_buffer_cache, conn->recv_buffer);
+	conn->recv_buffer = NULL;
+	conn->recv_len = 0;
+}
+
+/*
+ * Borrow the buffer for the response header, the request path goes along.
+ */
+static void send_buffer_get(struct connection *conn)
+{
+	struct response_buffer *rb = slab_alloc(&send_buffer_cache);
+	DIE(rb == NULL, "slab_alloc");
+
+	conn->send_buffer = rb->header;
+	conn->pathname = rb->pathname;
+	conn->arena.block = NULL;
+	memset(conn->headers, 0, sizeof(conn->headers));
+	conn->ranges = NULL;
+	conn->nranges = 0;
+	conn->path_entry = NULL;
+	conn->encoding = ENCODING_IDENTITY;
+	conn->vary = 0;
+	conn->keep_alive = 0;
+	conn->compress = 0;
+	conn->chunked = 0;
+	conn->trailers = 0;
+	conn->encoder = NULL;
+	conn->gzip = NULL;
+}
+
+/*
+ * Copy of a request header, kept in the response arena. NULL if the
+ * request did not have it.
+ */
+static char *request_header_dup(struct connection *conn, enum request_header h)
+{
+	char *value;
+
+	if (request_headers[h].value == NULL)
+		return NULL;
+
+	value = arena_alloc(&conn->arena, request_headers[h].len + 1);
+	if (value == NULL)
+		return NULL;
+	memcpy(value, request_headers[h].value, request_headers[h].len);
+	value[request_headers[h].len] = '\0';
+
+	return value;
+}
+
+static void send_buffer_put(struct connection *conn)
+{
+	if (conn->send_buffer == NULL)
+		return;
+
+	arena_release(&conn->arena);
+	slab_free(&send_buffer_cache, conn->send_buffer);
+	conn->send_buffer = NULL;
+	conn->pathname = NULL;
+}
+
+/*
+ * Close the file of the response; precompressed variants stay open in
+ * the path index.
+ */
+static void file_close(struct connection *conn)
+{
+	if (conn->path_entry != NULL) {
+		path_index_put(conn->path_entry);
+		conn->path_entry = NULL;
+	} else if (conn->fd >= 0) {
+		close(conn->fd);
+		load.open_files--;
+	}
+	conn->fd = -1;
+}
+
+/*
+ * Wait at most as long as the configuration allows for timeout; a limit
+ * of 0 leaves the connection without a timer.
+ */
+static void connection_timer(struct connection *conn,
+		enum connection_timeout timeout)
+{
+	int seconds;
+
+	conn->timeout = timeout;
+	switch (timeout) {
+	case TIMEOUT_HEADER:
+		seconds = config.header_timeout;
+		break;
+	case TIMEOUT_IDLE:
+		seconds = config.idle_timeout;
+		break;
+	default:
+		conn->rate_mark = 0;
+		seconds = config.min_rate > 0 ? AWS_RATE_WINDOW : 0;
+		break;
+	}
+
+	if (seconds > 0)
+		timer_arm(&conn->timer, seconds * 1000);
+	else
+		timer_cancel(&conn->timer);
+}
+
+/*
+ * Release connection memory and the file it was serving.
+ */
+static void connection_free(struct connection *conn)
+{
+	transfer_finish(conn);
+	if (conn->fd >= 0)
+		file_close(conn);
+
+	recv_buffer_put(conn);
+	send_buffer_put(conn);
+	client_table_disconnect(conn->client);
+	slab_free(&connection_cache, conn);
+	load.connections--;
+}
+
+/*
+ * The response is complete and the client keeps the connection: wait for
+ * its next request, holding nothing but the connection itself.
+ */
+static void connection_reuse(struct connection *conn)
+{
+	int rc;
+
+	transfer_finish(conn);
+	if (conn->fd >= 0)
+		file_close(conn);
+	send_buffer_put(conn);
+
+	connection_timer(conn, TIMEOUT_IDLE);
+	conn->state = STATE_INITIAL;
+	conn->parked = 0;
+	rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_in");
+}
+
 /*
  * Remove connection handler.
  */
 static void connection_remove(struct connection *conn)
 {
-	if (conn->fd > 0)
-		close(conn->fd);
+	timer_cancel(&conn->timer);
+	timer_cancel(&conn->throttle);
+	send_sched_remove(&conn->run);
 	close(conn->sockfd);
-	conn->state = STATE_CONNECTION_CLOSED;
 
-	free(conn);
+	/* Reads still in flight target our buffers, free on completion */
+	if (transfer_busy(conn)) {
+		conn->state = STATE_CONNECTION_CLOSED;
+		return;
+	}
+
+	connection_free(conn);
+}
+
+/*
+ * The timer of conn went off: the client sent nothing in time, or its
+ * response moved less than --min-rate per second over the last window.
+ */
+static void connection_timeout(struct timer *t)
+{
+	struct connection *conn = (struct connection *)
+		((char *) t - offsetof(struct connection, timer));
+	struct linger reset = { 1, 0 };
+	off_t progress;
+	int rc;
+
+	if (conn->timeout == TIMEOUT_RATE) {
+		progress = transfer_progress(conn);
+		/*
+		 * the server, not the client, is holding the response back:
+		 * opening the file, reading or compressing it, waiting for
+		 * a turn of the run queue or shaping
+		 */
+		if (conn->state == STATE_FILE_OPENING || transfer_busy(conn) ||
+				sched_queued(&conn->run) || conn->throttled ||
+				progress - conn->rate_mark >=
+				(off_t) (config.min_rate * AWS_RATE_WINDOW)) {
+			conn->rate_mark = progress;
+			conn->throttled = 0;
+			timer_arm(t, AWS_RATE_WINDOW * 1000);
+			return;
+		}
+		/* close() would still trickle the queued bytes to the client */
+		if (setsockopt(conn->sockfd, SOL_SOCKET, SO_LINGER, &reset,
+				sizeof(reset)) < 0)
+			ERR("setsockopt");
+	}
+
+	/* part of a request came in: tell the client why it goes */
+	if (conn->timeout == TIMEOUT_HEADER && conn->recv_len > 0 &&
+			send(conn->sockfd, timeout_response,
+				sizeof(timeout_response) - 1, MSG_DONTWAIT) < 0)
+		dlog(LOG_DEBUG, "send of 408 failed\n");
+
+	timeouts[conn->timeout]++;
+	dlog(LOG_INFO, "Connection %d timed out (%s)\n", conn->sockfd,
+			timeout_names[conn->timeout]);
+
+	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_remove_ptr");
+	connection_remove(conn);
+}
+
+/*
+ * conn used up what a bandwidth limit allows: it gets its next turn once
+ * the buckets have refilled.
+ */
+static void connection_throttle(struct connection *conn)
+{
+	conn->throttled = 1;
+	shaper_throttled();
+	/* a wheel tick would oversleep a wait of a few milliseconds */
+	if (!timer_pending(&conn->throttle))
+		timer_arm_precise(&conn->throttle, shaper_delay(&conn->shape,
+				transfer_remaining(conn)));
+}
+
+static void connection_unthrottle(struct timer *t)
+{
+	struct connection *conn = (struct connection *)
+		((char *) t - offsetof(struct connection, throttle));
+
+	send_sched_push(&conn->run, transfer_remaining(conn));
+}
+
+/*
+ * EPOLLERR also reports MSG_ZEROCOPY completions queued on the socket:
+ * only a hang-up or a pending socket error ends the connection.
+ */
+static int socket_failed(struct connection *conn, uint32_t events)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (events & EPOLLHUP)
+		return 1;
+	if (!(events & EPOLLERR))
+		return 0;
+
+	return getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+		err != 0;
+}
+
+/*
+ * Disk data became available for a connection waiting on it.
+ */
+static void connection_wakeup(struct connection *conn)
+{
+	int rc;
+
+	/* waiting for its turn, which comes without EPOLLOUT */
+	if (conn->parked)
+		return;
+
+	rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_out");
+}
+
+/*
+ * Turn away a client as it is accepted. Its request, if already there,
+ * is drained so that close() does not reset the answer away.
+ */
+static void reject_connection(int sockfd)
+{
+	char discard[BUFSIZ];
+
+	if (recv(sockfd, discard, sizeof(discard), MSG_DONTWAIT) < 0 &&
+			errno != EAGAIN)
+		dlog(LOG_DEBUG, "recv before 503 failed\n");
+	if (send(sockfd, overload_response, sizeof(overload_response) - 1,
+				MSG_DONTWAIT) < 0)
+		dlog(LOG_DEBUG, "send of 503 failed\n");
+	close(sockfd);
+}
+
+/* "address:port" of the client, for messages */
+static const char *peer_name(const struct connection *conn)
+{
+	static char name[32];
+
+	snprintf(name, sizeof(name), "%s:%d", inet_ntoa(conn->peer.sin_addr),
+			ntohs(conn->peer.sin_port));
+
+	return name;
 }
 
 /*
@@ -140,16 +500,60 @@ static void handle_new_connection(void)
 	socklen_t addrlen = sizeof(struct sockaddr_in);
 	struct sockaddr_in addr;
 	struct connection *conn;
+	struct client *client;
+	int one = 1;
 	int rc;
 
 	/* Accept new connection */
 	sockfd = accept(listenfd, (SSA *) &addr, &addrlen);
+	if (sockfd < 0 && (errno == EMFILE || errno == ENFILE)) {
+		/* hold off until connections close and give descriptors back */
+		admission_fd_exhausted(load.connections);
+		accept_failed = 1;
+		return;
+	}
+	if (sockfd < 0 && errno == ECONNABORTED)
+		return;
 	DIE(sockfd < 0, "accept");
 
+	if (overloaded) {
+		reject_connection(sockfd);
+		admission_rejected();
+		return;
+	}
+
+	/* one address may not take the whole connection budget */
+	if (client_table_connect(addr.sin_addr.s_addr, &client) < 0) {
+		reject_connection(sockfd);
+		return;
+	}
+
 	dlog(LOG_ERR, "Accepted connection from: %s:%d\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 
+	/* Responses are pushed from the event loop, never block on the socket */
+	rc = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	DIE(rc < 0, "fcntl");
+
+	/*
+	 * Engines gather or cork (MSG_MORE) what belongs together; Nagle
+	 * would only hold the tail of a response on a kept-alive connection
+	 * until the peer's delayed ACK.
+	 */
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+		ERR("setsockopt");
+
 	/* Instantiate new connection handler */
 	conn = connection_create(sockfd);
+	conn->peer = addr;
+	conn->client = client;
+	conn->accept_ns = stats_now_ns();
+	sched_link_init(&conn->run);
+	conn->parked = 0;
+	shaper_connection(&conn->shape, sockfd);
+	timer_init(&conn->throttle, connection_unthrottle);
+	conn->throttled = 0;
+	timer_init(&conn->timer, connection_timeout);
+	connection_timer(conn, TIMEOUT_HEADER);
 
 	/* Add socket to epoll */
 	rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
@@ -163,39 +567,71 @@ static int check_if_static_file_path(char *path){
 		return 0;
 }
 
+/*
+ * The request header is all in once an empty line ends it, CRLF or bare
+ * LF. A full buffer goes to the parser as it is. Only the bytes from
+ * the end of the previous read on are searched.
+ */
+static int request_complete(const struct connection *conn, size_t from)
+{
+	const char *start = conn->recv_buffer + (from > 3 ? from - 3 : 0);
+
+	return strstr(start, "\r\n\r\n") != NULL ||
+		strstr(start, "\n\n") != NULL ||
+		conn->recv_len == BUFSIZ - 1;
+}
+
 /*
  * Receive message on socket.
- * Store message in recv_buffer in struct connection.
+ * Store message in recv_buffer in struct connection, across reads until
+ * the request header is complete.
  */
 static enum connection_state receive_message(struct connection *conn)
 {
 	ssize_t bytes_recv;
+	size_t from = conn->recv_len;
 	int rc;
-	char abuffer[64];
 
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		ERR("get_peer_address");
-		goto remove_connection;
+	/* Data is waiting, only now does the connection need a buffer */
+	if (conn->recv_buffer == NULL) {
+		conn->recv_buffer = slab_alloc(&recv_buffer_cache);
+		DIE(conn->recv_buffer == NULL, "slab_alloc");
 	}
 
-	bytes_recv = recv(conn->sockfd, conn->recv_buffer, BUFSIZ, 0);
-	/* Error in communication */	
+	bytes_recv = recv(conn->sockfd, conn->recv_buffer + conn->recv_len,
+			BUFSIZ - 1 - conn->recv_len, 0);
+	/* Spurious wakeup, nothing to read yet */
+	if (bytes_recv < 0 && errno == EAGAIN) {
+		if (conn->recv_len == 0)
+			recv_buffer_put(conn);
+		return STATE_INITIAL;
+	}
+	/* Error in communication */
 	if (bytes_recv < 0) {
-		dlog(LOG_ERR, "Error in communication from: %s\n", abuffer);
+		dlog(LOG_ERR, "Error in communication from: %s\n",
+				peer_name(conn));
 		goto remove_connection;
 	}
 	/* Connection closed */
 	if (bytes_recv == 0) {
-		dlog(LOG_INFO, "Connection closed from: %s\n", abuffer);
+		dlog(LOG_INFO, "Connection closed from: %s\n", peer_name(conn));
 		goto remove_connection;
 	}
 
-	dlog(LOG_DEBUG, "Received message from: %s\n", abuffer);
+	conn->recv_len += bytes_recv;
+	conn->recv_buffer[conn->recv_len] = '\0';
+
+	/* the rest comes in later reads, all under the header timeout */
+	if (!request_complete(conn, from)) {
+		if (conn->timeout == TIMEOUT_IDLE)
+			connection_timer(conn, TIMEOUT_HEADER);
+		return STATE_INITIAL;
+	}
+
+	dlog(LOG_DEBUG, "Received message from: %s\n", peer_name(conn));
 
 	printf("--\n%s--\n", conn->recv_buffer);
 
-	conn->recv_len = bytes_recv;
 	conn->state = STATE_DATA_RECEIVED;
 
 	return STATE_DATA_RECEIVED;
@@ -211,281 +647,714 @@ remove_connection:
 }
 
 /*
- * Wait for asynchronous I/O operations
- * (io_getevents)
+ * Send message on socket.
+ * The body engine sends the header in send_buffer along with the body.
  */
-static int wait_aio(io_context_t ctx, int nops)
+static enum connection_state send_message(struct connection *conn)
 {
-	struct io_event *events;
+	enum transfer_status status;
+	size_t budget;
 	int rc;
 
-	/* Alloc structure */
-	events = (struct io_event *) malloc(nops * sizeof(struct io_event));
-	if (events == NULL){
-		ERR("malloc");
+	dlog(LOG_DEBUG, "Sending message to %s\n", peer_name(conn));
+
+	/* Error responses are just the header */
+	if (conn->fd == -1) {
+		status = transfer_send_header(conn, 0);
+	} else {
+		/* a quantum, as far as the bandwidth limits allow */
+		budget = shaper_budget(&conn->shape, config.send_quantum > 0 ?
+				config.send_quantum : SIZE_MAX);
+		conn->turn_left = budget;
+		status = transfer_send(conn);
+		shaper_charge(&conn->shape, budget - conn->turn_left);
 	}
 
-	/* Wait for async operations to finish */
-	rc = io_getevents(ctx, nops, nops, events, NULL);
-	if (rc < 0){
-		ERR("io_getevents");
+	switch (status) {
+	case TRANSFER_AGAIN:
+		/* a turn from the run queue filled the socket */
+		if (conn->parked) {
+			conn->parked = 0;
+			rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+			DIE(rc < 0, "w_epoll_update_ptr_out");
+		}
+		return STATE_DATA_RECEIVED;
+	case TRANSFER_YIELD:
+		/* More to send: wait for the next turn, not for EPOLLOUT */
+		if (!conn->parked) {
+			conn->parked = 1;
+			rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+			DIE(rc < 0, "w_epoll_update_ptr_none");
+		}
+		if (shaper_delay(&conn->shape, transfer_remaining(conn)) > 0)
+			connection_throttle(conn);
+		else
+			send_sched_push(&conn->run, transfer_remaining(conn));
+		return STATE_DATA_RECEIVED;
+	case TRANSFER_WAIT:
+		/* Stop polling the socket until the disk catches up */
+		conn->parked = 0;
+		rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+		DIE(rc < 0, "w_epoll_update_ptr_none");
+		return STATE_DATA_RECEIVED;
+	case TRANSFER_ERROR:
+		dlog(LOG_ERR, "Error in communication to %s\n", peer_name(conn));
+		fprintf(stderr, "Error sending %s to %s\n", conn->pathname,
+				peer_name(conn));
+		goto remove_connection;
+	case TRANSFER_DONE:
+		break;
 	}
 
-	free(events);
+	conn->state = STATE_DATA_SENT;
+	if (conn->keep_alive && !transfer_busy(conn)) {
+		connection_reuse(conn);
+		return STATE_INITIAL;
+	}
 
-	return rc;
-}
+remove_connection:
 
-/* Reads from the file into a buffer */
-static void prep_io_read_from_file(struct connection *conn, io_context_t *ctx){
+	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_remove_ptr");
 
-	/* Allocate iocb_read and piocb_read */
-	conn->iocb_read = (struct iocb *) malloc(conn->iocbs * sizeof(struct iocb));
-	if (conn->iocb_read == NULL){
-		ERR("malloc");
-	}
+	/* Remove current connection */
+	connection_remove(conn);
 
-	conn->piocb_read = (struct iocb **) malloc(conn->iocbs * sizeof(struct iocb *));
-	if (conn->piocb_read == NULL){
-		ERR("malloc");
-	}
+	return STATE_CONNECTION_CLOSED;
 }
 
-/* Uses the buffer filled by the read function and sends the
- * the file on sockfd.
+/*
+ * Give the connection at the head of the run queue its next send turn.
  */
-static void prep_io_write_to_socket(struct connection *conn, io_context_t *ctx){
+static void send_turn(void)
+{
+	struct sched_link *l = send_sched_pop();
 
-	/* Allocate iocb_write and piocb_write */
-	conn->iocb_write = (struct iocb *) malloc(conn->iocbs * sizeof(struct iocb));
-	if (conn->iocb_write == NULL){
-		ERR("malloc");
-	}
+	if (l == NULL)
+		return;
 
-	conn->piocb_write = (struct iocb **) malloc(conn->iocbs * sizeof(struct iocb *));
-	if (conn->piocb_write == NULL){
-		ERR("malloc");
-	}
+	ALLOC_PHASE(ALLOC_SEND);
+	send_message((struct connection *)
+			((char *) l - offsetof(struct connection, run)));
 }
 
-void do_aio_transfer(struct connection *conn){
-	/* Process dynamic files */
-	int i, rc, n_aio_ops;
+static void prepare_response(struct connection *conn);
+static void refuse_request(struct connection *conn, const char *status,
+		const char *headers);
+static void reject_method(struct connection *conn);
 
-	/* Initialize new connection */
-	conn->efd = eventfd(0, 0);
-	if (conn->efd < 0){
-		ERR("eventfd");
+/*
+ * A reader thread finished open() + fstat(), or stat() for HEAD, for conn.
+ */
+static void handle_file_opened(struct pool_job *job)
+{
+	struct connection *conn = (struct connection *)
+		((char *) job - offsetof(struct connection, open_job));
+
+	conn->inflight--;
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		if (job->op == POOL_OPEN && job->res >= 0)
+			close(job->res);
+		if (conn->inflight == 0)
+			connection_free(conn);
+		return;
 	}
 
-	conn->iocbs = conn->buf->st_size / BUFSIZ + (conn->buf->st_size % BUFSIZ == 0 ? 0 : 1);
+	ALLOC_PHASE(ALLOC_OPEN);
+	if (job->op == POOL_OPEN)
+		conn->fd = job->res >= 0 ? job->res : -1;
+	else if (job->res < 0)
+		conn->st.st_mode = 0;
+	if (conn->fd >= 0)
+		load.open_files++;
+	conn->state = STATE_DATA_RECEIVED;
+	prepare_response(conn);
+}
 
-	conn->buffer = calloc(conn->iocbs, sizeof(char*));
-	for (i = 0; i < conn->iocbs; i++)
-		conn->buffer[i] = calloc(BUFSIZ, sizeof(char));
+/*
+ * Handle a client request on a client connection.
+ */
+static void handle_client_request(struct connection *conn)
+{
+	int rc, i, path_len;
+	long unsigned int bytes_parsed;
+	enum connection_state ret_state;
 
-	io_context_t ctx = 0;
+	ALLOC_PHASE(ALLOC_RECEIVE);
+	ret_state = receive_message(conn);
+	if (ret_state != STATE_DATA_RECEIVED)
+		return;
 
-	/* Setup aio context */
-	rc = io_setup(1, &ctx);
-	if (rc < 0){
-		ERR("io_submit");
-	}
+	/* from now on the response has to keep moving */
+	connection_timer(conn, TIMEOUT_RATE);
 
-	/* Alloc iocb_read and piocb_read */
-	prep_io_read_from_file(conn, &ctx);
+	conn->start_ns = stats_now_ns();
 
-	/* Alloc iocb_write and piocb_write */
-	prep_io_write_to_socket(conn, &ctx);
+	ALLOC_PHASE(ALLOC_PARSE);
 
-	/* Submit aio */
-	rc = 0;
-	int size = conn->buf->st_size > BUFSIZ ? BUFSIZ : conn->buf->st_size;
-	for (i = 0; i < conn->iocbs; i++){
-		io_prep_pread(&(conn->iocb_read[i]), conn->fd, conn->buffer[i], size, i * BUFSIZ);
-		conn->piocb_read[i] = &(conn->iocb_read[i]);
-		io_set_eventfd(&(conn->iocb_read[i]), conn->efd);
+	/* Init HTTP_REQUEST parser */
+	http_parser_init(&request_parser, HTTP_REQUEST);
 
-		/* Submit aio */
-		n_aio_ops = io_submit(ctx, 1, &(conn->piocb_read[i]));
-		fprintf(stderr, "%i\n", n_aio_ops);
-		if (n_aio_ops < 0){
-			ERR("io_submit");
-		}
+	memset(request_path, 0, BUFSIZ);
+	memset(request_headers, 0, sizeof(request_headers));
+	request_header = REQUEST_HEADERS;
+	bytes_parsed = http_parser_execute(&request_parser, &settings_on_path, conn->recv_buffer, conn->recv_len);
+	fprintf(stderr, "Parsed HTTP request (bytes: %lu), path: %s\n", bytes_parsed, request_path);
 
-		rc = 0;
-		while (rc < 1){
-			/* Wait for completion*/
-			rc = wait_aio(ctx, 1);
+	/* The request is consumed, trade its buffer for the response one */
+	send_buffer_get(conn);
+	for (i = 0; i < REQUEST_HEADERS; i++)
+		conn->headers[i] = request_header_dup(conn, i);
+	conn->http11 = request_parser.http_major > 1 ||
+		(request_parser.http_major == 1 && request_parser.http_minor >= 1);
+	/* a connection with more bytes than one request is closed after it */
+	conn->keep_alive = conn->http11 &&
+		http_should_keep_alive(&request_parser) &&
+		bytes_parsed == conn->recv_len;
+	recv_buffer_put(conn);
+
+	path_len = snprintf(conn->pathname, BUFSIZ, "%s%s", AWS_DOCUMENT_ROOT,
+			request_path);
+	conn->dynamic = !check_if_static_file_path(request_path);
+	shaper_attach(&conn->shape, request_path);
+
+	/* first request: how long did the loop leave the connection waiting */
+	if (conn->accept_ns != 0) {
+		uint64_t sojourn = conn->start_ns - conn->accept_ns;
+
+		conn->accept_ns = 0;
+		if (config.codel_target > 0 &&
+				admission_codel(sojourn, conn->start_ns)) {
+			refuse_request(conn, "503 Service Unavailable",
+					"Retry-After: 1\r\n");
+			return;
 		}
+	}
 
-		io_prep_pwrite(&(conn->iocb_write[i]), conn->sockfd, conn->buffer[i], size, 0);
-		conn->piocb_write[i] = &(conn->iocb_write[i]);
-		io_set_eventfd(&(conn->iocb_write[i]), conn->efd);
+	/* a client over its request rate costs no file system work */
+	if (client_table_request(conn->client)) {
+		refuse_request(conn, "429 Too Many Requests", "Retry-After: 1\r\n");
+		return;
+	}
 
-		/* Submit aio */
-		n_aio_ops = io_submit(ctx, 1, &(conn->piocb_write[i]));
-		fprintf(stderr, "%i\n", n_aio_ops);
-		if (n_aio_ops < 0){
-			ERR("io_submit");
-		}
+	conn->head = request_parser.method == HTTP_HEAD;
+	if (!conn->head && request_parser.method != HTTP_GET) {
+		reject_method(conn);
+		return;
+	}
+
+	/* cut short, the path would name some other file */
+	if (path_len >= BUFSIZ) {
+		refuse_request(conn, "414 URI Too Long", "");
+		return;
+	}
+
+	ALLOC_PHASE(ALLOC_OPEN);
+
+	/* HEAD of a file the path index knows costs no system call at all */
+	if (conn->head && path_index_lookup(conn->pathname, &conn->st) == 0) {
+		prepare_response(conn);
+		return;
+	}
 
-		rc = 0;
-		while (rc < 1){
-			/* Wait for completion*/
-			rc = wait_aio(ctx, 1);
+	/* With reader threads running, open() may block too: offload it */
+	if (reader_pool_active()) {
+		conn->open_job.op = conn->head ? POOL_STAT : POOL_OPEN;
+		conn->open_job.path = conn->pathname;
+		conn->open_job.st = &conn->st;
+		conn->open_job.complete = handle_file_opened;
+		if (reader_pool_submit(&conn->open_job) == 0) {
+			conn->inflight++;
+			conn->state = STATE_FILE_OPENING;
+			rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+			DIE(rc < 0, "w_epoll_update_ptr_none");
+			return;
 		}
 	}
 
-	/* Destroy aio context */
-	io_destroy(ctx);
+	/* HEAD needs the metadata only */
+	if (conn->head) {
+		if (stat(conn->pathname, &conn->st) < 0)
+			conn->st.st_mode = 0;
+		prepare_response(conn);
+		return;
+	}
+
+	conn->fd = open(conn->pathname, O_RDONLY);
+	if (conn->fd != -1 && fstat(conn->fd, &conn->st) < 0) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	if (conn->fd != -1)
+		load.open_files++;
+
+	prepare_response(conn);
 }
 
 /*
- * Send message on socket.
- * Store message in send_buffer in struct connection.
+ * Status line of the response. HTTP/1.1 clients learn whether the
+ * connection stays open; HTTP/1.0 ones get what they always got.
  */
-static enum connection_state send_message(struct connection *conn)
+static int response_status(const struct connection *conn, char *buf,
+		size_t len, const char *status)
 {
-	ssize_t bytes_sent;
-	int rc, i;
-	char abuffer[64];
+	if (!conn->http11)
+		return snprintf(buf, len, "HTTP/1.0 %s\r\n", status);
 
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		ERR("get_peer_address");
-		goto remove_connection;
-	}
+	return snprintf(buf, len, "HTTP/1.1 %s\r\n%s", status,
+			conn->keep_alive ? "" : "Connection: close\r\n");
+}
 
-	bytes_sent = send(conn->sockfd, conn->send_buffer, conn->send_len, 0);
-	if (bytes_sent < 0) {
-		dlog(LOG_ERR, "Error in communication to %s\n", abuffer);
-		fprintf(stderr, "Error in communication to %s\n", abuffer);
-		goto remove_connection;
-	}
-	if (bytes_sent == 0) {
-		dlog(LOG_INFO, "Connection closed to %s\n", abuffer);
-		fprintf(stderr, "Connection closed to %s\n", abuffer);
-		goto remove_connection;
+/* End of the header of a response without a body */
+static int response_empty(const struct connection *conn, char *buf, size_t len)
+{
+	return snprintf(buf, len, conn->keep_alive ?
+			"Content-Length: 0\r\n\r\n" : "\r\n");
+}
+
+/* Non-zero if the comma separated list in value names token */
+static int header_has_token(const char *value, const char *token)
+{
+	size_t len = strlen(token);
+
+	while (value != NULL && *value != '\0') {
+		value += strspn(value, " \t,");
+		if (strncasecmp(value, token, len) == 0 &&
+				strchr(" \t;,", value[len]) != NULL)
+			return 1;
+		value += strcspn(value, ",");
 	}
 
-	dlog(LOG_DEBUG, "Sending message to %s\n", abuffer);
+	return 0;
+}
 
-	printf("--\n%s--\n", conn->send_buffer);
+/* Media type of the file at path, by its extension */
+static const char *content_type(const char *path)
+{
+	static const struct {
+		const char *ext;
+		const char *type;
+	} types[] = {
+		{ "html", "text/html" },
+		{ "htm", "text/html" },
+		{ "css", "text/css" },
+		{ "js", "text/javascript" },
+		{ "json", "application/json" },
+		{ "txt", "text/plain" },
+		{ "xml", "application/xml" },
+		{ "svg", "image/svg+xml" },
+		{ "png", "image/png" },
+		{ "jpg", "image/jpeg" },
+		{ "jpeg", "image/jpeg" },
+		{ "gif", "image/gif" },
+		{ "ico", "image/x-icon" },
+		{ "wasm", "application/wasm" },
+		{ "pdf", "application/pdf" },
+	};
+	const char *ext = strrchr(path, '.');
+	size_t i;
+
+	if (ext != NULL && strchr(ext, '/') == NULL)
+		for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+			if (strcasecmp(ext + 1, types[i].ext) == 0)
+				return types[i].type;
+
+	return "application/octet-stream";
+}
 
-	/* If there isn't an error, then send files either with sendfile or aio */
-	if (conn->fd != -1){
-		conn->buf = calloc(1, sizeof(struct stat));
+/*
+ * Resolve the Range header of the request against the opened file.
+ * Returns -1 if none of the ranges can be served.
+ */
+static int prepare_ranges(struct connection *conn)
+{
+	int n;
 
-		fstat(conn->fd, conn->buf);
+	if (conn->headers[HEADER_RANGE] == NULL ||
+			!validator_range_ok(&conn->st, conn->headers[HEADER_IF_RANGE]))
+		return 0;
 
-		if (check_if_static_file_path(request_path)){
-			/* Process static files */
+	conn->ranges = arena_alloc(&conn->arena,
+			AWS_MAX_RANGES * sizeof(*conn->ranges));
+	if (conn->ranges == NULL)
+		return 0;
 
-			off_t total_sent = 0;
-			int size = BUFSIZ;
+	n = range_parse(conn->headers[HEADER_RANGE], conn->st.st_size, conn->ranges,
+			AWS_MAX_RANGES);
+	conn->nranges = n > 0 ? n : 0;
 
-			while (total_sent < conn->buf->st_size){
-				if (total_sent + BUFSIZ >= conn->buf->st_size)
-					size = total_sent + BUFSIZ - conn->buf->st_size;
+	return n < 0 ? -1 : 0;
+}
 
-				rc = sendfile(conn->sockfd, conn->fd, NULL, conn->buf->st_size);
-				if (rc == -1){
-					ERR("sendfile\n");
-				}
-				else{
-					total_sent += rc;
-					bytes_sent += rc;
-				}
-			}
-		}
-		else{
-			do_aio_transfer(conn);
+/*
+ * Static files go out precompressed when a sidecar the client accepts
+ * exists. The sidecar then stands in for the file, validators included.
+ */
+static void select_encoding(struct connection *conn)
+{
+	struct path_entry *e;
+	enum content_encoding encoding;
 
-			/* Free resources */
-			for (i = 0; i < conn->iocbs; i++){
-				free(conn->buffer[i]);
-			}
-			free(conn->buffer);
-			free(conn->iocb_read);
-			free(conn->iocb_write);
-			free(conn->piocb_read);
-			free(conn->piocb_write);
-		}
-	
-		free(conn->buf);
+	e = path_index_get(conn->pathname, &conn->st);
+	if (e == NULL)
+		return;
+
+	conn->vary = e->variants != 0;
+	encoding = encoding_negotiate(conn->headers[HEADER_ACCEPT_ENCODING],
+			e->variants);
+	if (encoding == ENCODING_IDENTITY) {
+		path_index_put(e);
+		return;
 	}
 
-	/* All done - remove out notification */
-	rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_update_ptr_in");
+	conn->st = e->st[encoding];
+	conn->encoding = encoding;
+	/* HEAD takes the variant's metadata and leaves it alone */
+	if (conn->head) {
+		path_index_put(e);
+		return;
+	}
 
-	conn->state = STATE_DATA_SENT;
+	close(conn->fd);
+	load.open_files--;
+	conn->path_entry = e;
+	conn->fd = e->fd[encoding];
+}
 
-remove_connection:
+/*
+ * With --gzip, dynamic files go out gzipped to clients that accept it.
+ * Ranges are only served from the file as it is.
+ */
+static void select_compression(struct connection *conn)
+{
+	if (conn->st.st_size < AWS_GZIP_MIN)
+		return;
 
-	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_remove_ptr");
+	conn->vary = 1;
+	if (conn->headers[HEADER_RANGE] != NULL ||
+			encoding_negotiate(conn->headers[HEADER_ACCEPT_ENCODING],
+				1U << ENCODING_GZIP) != ENCODING_GZIP)
+		return;
 
-	/* Remove current connection */
-	connection_remove(conn);
+	conn->encoding = ENCODING_GZIP;
+	conn->compress = 1;
+	/* the length is not known up front: chunks, or the end of the connection */
+	conn->chunked = conn->http11;
+	conn->keep_alive &= conn->chunked;
+	conn->trailers = conn->chunked &&
+		header_has_token(conn->headers[HEADER_TE], "trailers");
+}
 
-	return STATE_CONNECTION_CLOSED;
+/* name of a coding applied on the fly, which the validators depend on */
+static const char *representation_variant(const struct connection *conn)
+{
+	return conn->compress ? encoding_names[conn->encoding] : NULL;
+}
+
+/* Validators of the file and the coding it is sent in */
+static int representation_headers(struct connection *conn, char *buf,
+		size_t len)
+{
+	int n = validator_headers(buf, len, &conn->st,
+			representation_variant(conn));
+
+	if (conn->encoding != ENCODING_IDENTITY)
+		n += snprintf(buf + n, len - n, "Content-Encoding: %s\r\n",
+				encoding_names[conn->encoding]);
+	if (conn->vary)
+		n += snprintf(buf + n, len - n, "Vary: Accept-Encoding\r\n");
+
+	return n;
 }
 
 /*
- * Handle a client request on a client connection.
+ * Response header for the file in conn: 200, 206 for one range or 206
+ * with a multipart/byteranges body for several.
  */
-static void handle_client_request(struct connection *conn)
+static int build_header(struct connection *conn)
 {
-	int rc;
-	long unsigned int bytes_parsed;
-	enum connection_state ret_state;
+	const struct byte_range *r = conn->ranges;
+	char *buf = conn->send_buffer;
+	char boundary[AWS_BOUNDARY_LEN + 1];
+	int len;
+
+	conn->content_type = content_type(conn->pathname);
+
+	/* compressed: chunked, or delimited by closing the connection */
+	if (conn->compress) {
+		len = response_status(conn, buf, BUFSIZ, "200 OK");
+		len += representation_headers(conn, buf + len, BUFSIZ - len);
+		len += snprintf(buf + len, BUFSIZ - len, "Content-Type: %s\r\n",
+				conn->content_type);
+		if (conn->trailers)
+			len += snprintf(buf + len, BUFSIZ - len,
+					"Trailer: Server-Timing\r\n");
+		return len + snprintf(buf + len, BUFSIZ - len, conn->chunked ?
+				"Transfer-Encoding: chunked\r\n\r\n" : "\r\n");
+	}
 
-	ret_state = receive_message(conn);
-	if (ret_state == STATE_CONNECTION_CLOSED)
-		return;
+	len = response_status(conn, buf, BUFSIZ, conn->nranges == 0 ? "200 OK" :
+			"206 Partial Content");
+	len += representation_headers(conn, buf + len, BUFSIZ - len);
+	len += snprintf(buf + len, BUFSIZ - len, "Accept-Ranges: bytes\r\n");
+
+	if (conn->nranges == 0)
+		return len + snprintf(buf + len, BUFSIZ - len,
+				"Content-Type: %s\r\n"
+				"Content-Length: %lld\r\n\r\n",
+				conn->content_type, (long long) conn->st.st_size);
+
+	if (conn->nranges == 1)
+		return len + snprintf(buf + len, BUFSIZ - len,
+				"Content-Type: %s\r\n"
+				"Content-Range: bytes %lld-%lld/%lld\r\n"
+				"Content-Length: %lld\r\n\r\n",
+				conn->content_type, (long long) r->start, (long long) r->end - 1,
+				(long long) conn->st.st_size,
+				(long long) (r->end - r->start));
+
+	range_boundary(&conn->st, boundary);
+
+	return len + snprintf(buf + len, BUFSIZ - len,
+			"Content-Type: multipart/byteranges; boundary=%s\r\n"
+			"Content-Length: %lld\r\n\r\n", boundary,
+			(long long) range_multipart_length(&conn->st,
+				conn->content_type, r, conn->nranges));
+}
 
-	/* Init HTTP_REQUEST parser */
-	http_parser_init(&request_parser, HTTP_REQUEST);
+/* The file exists: opened for GET, a regular file by stat() for HEAD */
+static int response_has_file(const struct connection *conn)
+{
+	if (conn->head)
+		return S_ISREG(conn->st.st_mode);
+
+	return conn->fd != -1;
+}
+
+/*
+ * Build the response for the opened file (conn->fd == -1 for 404). HEAD
+ * gets the same header and no body.
+ */
+static void prepare_response(struct connection *conn)
+{
+	int rc;
+
+	if (conn->fd != -1 && !S_ISREG(conn->st.st_mode))
+		file_close(conn);
+	if (response_has_file(conn) && !conn->dynamic)
+		select_encoding(conn);
+	if (response_has_file(conn) && conn->dynamic && config.gzip_level > 0)
+		select_compression(conn);
 
-	memset(request_path, 0, BUFSIZ);
-	bytes_parsed = http_parser_execute(&request_parser, &settings_on_path, conn->recv_buffer, conn->recv_len);
-	fprintf(stderr, "Parsed HTTP request (bytes: %lu), path: %s\n", bytes_parsed, request_path);
-	
-	memset(conn->pathname, 0, BUFSIZ);
-	sprintf(conn->pathname, "%s%s", AWS_DOCUMENT_ROOT, request_path);
-	conn->fd = open(conn->pathname, O_RDWR);
-	
 	/* Fill in response */
-	memset(conn->send_buffer, 0, BUFSIZ);
-	if (conn->fd == -1){
-		sprintf(conn->send_buffer, "HTTP/1.0 404 Not Found\r\n\r\n");
-		conn->send_len = strlen("HTTP/1.0 404 Not Found\r\n\r\n");
+	if (!response_has_file(conn)) {
+		conn->send_len = response_status(conn, conn->send_buffer, BUFSIZ,
+				"404 Not Found");
+		conn->send_len += response_empty(conn,
+				conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len);
+	}
+	else if (validator_not_modified(&conn->st,
+				representation_variant(conn),
+				conn->headers[HEADER_IF_NONE_MATCH],
+				conn->headers[HEADER_IF_MODIFIED_SINCE])) {
+		/* The client has this version: validators only, no body */
+		conn->send_len = response_status(conn, conn->send_buffer, BUFSIZ,
+				"304 Not Modified");
+		conn->send_len += representation_headers(conn,
+				conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len);
+		conn->send_len += snprintf(conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len, "\r\n");
+		file_close(conn);
+	}
+	else if (prepare_ranges(conn) < 0) {
+		/* Nothing to send but the header */
+		conn->send_len = response_status(conn, conn->send_buffer, BUFSIZ,
+				"416 Range Not Satisfiable");
+		conn->send_len += snprintf(conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len, "Content-Range: bytes */%lld\r\n",
+				(long long) conn->st.st_size);
+		conn->send_len += response_empty(conn,
+				conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len);
+		file_close(conn);
 	}
 	else{
-		sprintf(conn->send_buffer, "HTTP/1.0 200 OK\r\n\r\n");
-		conn->send_len = strlen("HTTP/1.0 200 OK\r\n\r\n");
+		conn->send_len = build_header(conn);
+
+		/* Pick a transfer strategy; tiny bodies land in send_buffer */
+		ALLOC_PHASE(ALLOC_SEND);
+		if (!conn->head && transfer_start(conn) < 0) {
+			ERR("transfer_start");
+			rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+			DIE(rc < 0, "w_epoll_remove_ptr");
+			connection_remove(conn);
+			return;
+		}
 	}
+	conn->send_pos = 0;
 
-	/* Add socket to epoll for out events */
-	rc = w_epoll_update_ptr_inout(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_ptr_inout");
+	/* Wait for the socket to become writable */
+	rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_out");
+}
+
+/*
+ * Header-only answer sent before the filesystem is looked at; the
+ * connection ends with it.
+ */
+static void refuse_request(struct connection *conn, const char *status,
+		const char *headers)
+{
+	char *buf = conn->send_buffer;
+	int rc, len;
+
+	conn->keep_alive = 0;
+	len = response_status(conn, buf, BUFSIZ, status);
+	len += snprintf(buf + len, BUFSIZ - len, "%s", headers);
+	conn->send_len = len + response_empty(conn, buf + len, BUFSIZ - len);
+	conn->send_pos = 0;
+
+	rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_out");
+}
+
+/*
+ * Methods other than GET and HEAD are refused before the filesystem is
+ * looked at: 405 for the ones the parser knows, 501 when it gave up on
+ * the method. The request body is never read, so the connection closes.
+ */
+static void reject_method(struct connection *conn)
+{
+	/* the parser stops at a method it does not know */
+	if (request_path[0] == '\0')
+		refuse_request(conn, "501 Not Implemented", "");
+	else
+		refuse_request(conn, "405 Method Not Allowed",
+				"Allow: GET, HEAD\r\n");
+}
+
+static void listen_set(int on)
+{
+	int rc;
+
+	if (on == listening)
+		return;
+
+	if (on) {
+		rc = w_epoll_add_fd_in(epollfd, listenfd);
+		DIE(rc < 0, "w_epoll_add_fd_in");
+	} else {
+		rc = w_epoll_remove_fd(epollfd, listenfd);
+		DIE(rc < 0, "w_epoll_remove_fd");
+	}
+	listening = on;
+}
+
+/*
+ * Follow the load across the admission limits. Overloaded, the listener
+ * leaves the epoll set, or stays to answer 503 as long as accept() has
+ * descriptors to give.
+ */
+static void admission_update(void)
+{
+	load.aio_bytes = transfer_aio_inflight();
+	overloaded = admission_overloaded(&load);
+	if (!overloaded)
+		accept_failed = 0;
+
+	listen_set(!overloaded ||
+			(strcmp(config.overload, "503") == 0 && !accept_failed));
+}
+
+static void dump_signal_handler(int signum)
+{
+	dump_requested = 1;
+}
+
+static void dump_stats(void)
+{
+	transfer_stats_dump(stderr);
+	slab_cache_dump(stderr, &connection_cache);
+	slab_cache_dump(stderr, &recv_buffer_cache);
+	slab_cache_dump(stderr, &send_buffer_cache);
+	if (alloc_stats_dump != NULL)
+		alloc_stats_dump(stderr);
+	admission_stats_dump(stderr);
+	send_sched_stats_dump(stderr);
+	shaper_stats_dump(stderr);
+	client_table_stats_dump(stderr);
+	fprintf(stderr, "timeouts: %s=%llu %s=%llu %s=%llu\n",
+			timeout_names[TIMEOUT_HEADER], timeouts[TIMEOUT_HEADER],
+			timeout_names[TIMEOUT_IDLE], timeouts[TIMEOUT_IDLE],
+			timeout_names[TIMEOUT_RATE], timeouts[TIMEOUT_RATE]);
+}
+
+/*
+ * Idle keep-alive clients cost a descriptor each; take every one we may.
+ */
+static void raise_fd_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == rl.rlim_max)
+		return;
+
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+		ERR("setrlimit");
 }
 
 int main(int argc, char **argv)
 {
+	struct transfer_hooks hooks = { connection_wakeup, connection_free };
+	struct sigaction sa;
 	int rc;
 
+	config_parse(argc, argv);
+
+	raise_fd_limit();
+	slab_cache_init(&connection_cache, "connection", sizeof(struct connection),
+			AWS_CACHE_LINE, AWS_CONNECTIONS_PER_SLAB);
+	slab_cache_init(&recv_buffer_cache, "recv buffer", BUFSIZ,
+			AWS_CACHE_LINE, AWS_BUFFERS_PER_SLAB);
+	slab_cache_init(&send_buffer_cache, "send buffer",
+			sizeof(struct response_buffer), AWS_CACHE_LINE,
+			AWS_BUFFERS_PER_SLAB);
+
+	path_index_init(AWS_PATH_INDEX);
+	send_sched_init();
+	shaper_init();
+	client_table_init();
+
+	/* Peers may vanish mid-transfer; report EPIPE instead of dying */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_signal_handler;
+	rc = sigaction(SIGUSR1, &sa, NULL);
+	DIE(rc < 0, "sigaction");
+
 	/* Init multiplexing */
 	epollfd = w_epoll_create();
 	DIE(epollfd < 0, "w_epoll_create");
 
+	eefd = transfer_init(&hooks);
+	if (config.calibrate)
+		transfer_calibrate();
+
 	/* Create server socket */
-	listenfd = tcp_create_listener(AWS_LISTEN_PORT, DEFAULT_LISTEN_BACKLOG);
+	listenfd = tcp_create_listener(AWS_LISTEN_PORT, AWS_LISTEN_BACKLOG);
 	DIE(listenfd < 0, "tcp_create_listener");
 
-	rc = w_epoll_add_fd_in(epollfd, listenfd);
+	listen_set(1);
+
+	rc = w_epoll_add_fd_in(epollfd, eefd);
+	DIE(rc < 0, "w_epoll_add_fd_in");
+
+	timerfd = timer_wheel_init();
+	rc = w_epoll_add_fd_in(epollfd, timerfd);
 	DIE(rc < 0, "w_epoll_add_fd_in");
 
 	dlog(LOG_INFO, "Server waiting for connections on port %d\n", AWS_LISTEN_PORT);
@@ -493,31 +1362,81 @@ int main(int argc, char **argv)
 	/* Server main loop */
 	while (1) {
 		struct epoll_event rev;
-
-		/* Wait for events */
-		rc = w_epoll_wait_infinite(epollfd, &rev);
+		struct connection *conn;
+
+		/* Wait for events; only look while connections wait for a turn */
+		if (send_sched_empty())
+			rc = w_epoll_wait_infinite(epollfd, &rev);
+		else
+			rc = w_epoll_wait_timeout(epollfd, &rev, 0);
+		if (dump_requested) {
+			dump_requested = 0;
+			dump_stats();
+		}
+		if (rc < 0 && errno == EINTR)
+			continue;
 		DIE(rc < 0, "w_epoll_wait_infinite");
+		ALLOC_PHASE(ALLOC_OTHER);
+
+		/* nothing else to do: the run queue has the loop to itself */
+		if (rc == 0) {
+			send_turn();
+			admission_update();
+			continue;
+		}
 
 		/*
 		 * Switch event types; consider
 		 *   - new connection requests (on server socket)
+		 *   - finished asynchronous reads (on eefd)
+		 *   - timer wheel ticks (on timerfd)
 		 *   - socket communication (on connection sockets)
 		 */
 		if (rev.data.fd == listenfd) {
 			dlog(LOG_DEBUG, "New connection\n");
+			ALLOC_PHASE(ALLOC_ACCEPT);
 			if (rev.events & EPOLLIN)
 				handle_new_connection();
 		}
+		else if (rev.data.fd == eefd) {
+			/* Finished reads feed responses already being sent */
+			ALLOC_PHASE(ALLOC_SEND);
+			transfer_aio_complete();
+		}
+		else if (rev.data.fd == timerfd) {
+			timer_wheel_run();
+		}
 		else {
-			if (rev.events & EPOLLIN) {
+			conn = rev.data.ptr;
+			if (conn->state == STATE_INITIAL) {
 				dlog(LOG_DEBUG, "New message\n");
-				handle_client_request(rev.data.ptr);
+				handle_client_request(conn);
+			}
+			else if (conn->state == STATE_FILE_OPENING ||
+					(transfer_busy(conn) &&
+					 !(rev.events & EPOLLOUT) &&
+					 socket_failed(conn, rev.events))) {
+				/*
+				 * The client went away while the file is opened
+				 * or the body waits on the disk or the compressor:
+				 * the completion frees the connection
+				 */
+				rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+				DIE(rc < 0, "w_epoll_remove_ptr");
+				connection_remove(conn);
 			}
-			if (rev.events & EPOLLOUT) {
+			else {
 				dlog(LOG_DEBUG, "Ready to send message\n");
-				send_message(rev.data.ptr);
+				ALLOC_PHASE(ALLOC_SEND);
+				send_message(conn);
 			}
 		}
+
+		/* one queued turn per event, so neither starves the other */
+		send_turn();
+
+		/* the event may have moved the load across a limit */
+		admission_update();
 	}
 
 	return 0;
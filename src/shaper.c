@@ -0,0 +1,203 @@
+/*
+ * Asynchronous Web Server - bandwidth shaping
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/config.h"
+#include "../headers/stats.h"
+#include "../headers/shaper.h"
+
+static struct token_bucket global;
+static struct token_bucket paths[AWS_PATH_RATES];
+/* some limit is set, budgets are worth computing */
+static int active;
+
+static struct {
+	unsigned long long throttled;
+} stats;
+
+static uint64_t burst_of(uint64_t rate)
+{
+	uint64_t burst = rate * AWS_SHAPER_BURST_MS / 1000;
+
+	return burst > AWS_SHAPER_MIN_BURST ? burst : AWS_SHAPER_MIN_BURST;
+}
+
+static uint64_t min_u64(uint64_t a, uint64_t b)
+{
+	return a < b ? a : b;
+}
+
+void token_bucket_init(struct token_bucket *b, uint64_t rate, uint64_t burst)
+{
+	b->rate = rate;
+	b->burst = burst;
+	b->tokens = burst;
+	b->stamp = rate > 0 ? stats_now_ns() : 0;
+}
+
+uint64_t token_bucket_refill(struct token_bucket *b, uint64_t now)
+{
+	double add;
+
+	if (b->rate == 0)
+		return UINT64_MAX;
+	if (now <= b->stamp)
+		return b->tokens;
+
+	add = (double) (now - b->stamp) * b->rate / 1e9;
+	/* keep the stamp until a whole token came in, or none ever would */
+	if (add < 1 && b->tokens < b->burst)
+		return b->tokens;
+
+	if (add >= b->burst - b->tokens)
+		b->tokens = b->burst;
+	else
+		b->tokens += (uint64_t) add;
+	b->stamp = now;
+
+	return b->tokens;
+}
+
+unsigned int token_bucket_delay(const struct token_bucket *b, uint64_t want)
+{
+	uint64_t ms;
+
+	want = min_u64(want, b->burst);
+	if (b->rate == 0 || b->tokens >= want)
+		return 0;
+
+	ms = ((want - b->tokens) * 1000 + b->rate - 1) / b->rate;
+
+	return ms < UINT32_MAX ? ms : UINT32_MAX;
+}
+
+void shaper_init(void)
+{
+	int i;
+
+	token_bucket_init(&global, config.global_rate,
+			burst_of(config.global_rate));
+	for (i = 0; i < config.path_rates; i++)
+		token_bucket_init(&paths[i], config.path_rate[i].rate,
+				burst_of(config.path_rate[i].rate));
+
+	active = config.rate_limit > 0 || config.global_rate > 0 ||
+		config.path_rates > 0;
+}
+
+void shaper_connection(struct shaper *s, int sockfd)
+{
+	token_bucket_init(&s->own, config.rate_limit,
+			burst_of(config.rate_limit));
+	s->path = NULL;
+
+#ifdef SO_MAX_PACING_RATE
+	if (config.rate_limit > 0) {
+		static int refused;
+		unsigned int pacing = config.rate_limit < UINT32_MAX ?
+			config.rate_limit : UINT32_MAX - 1;
+
+		/* only a hint: older kernels or other sockets may refuse it,
+		 * which is worth a word once, not once per connection */
+		if (setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing,
+				sizeof(pacing)) < 0 && !refused) {
+			refused = 1;
+			ERR("setsockopt SO_MAX_PACING_RATE");
+		}
+	}
+#endif
+}
+
+void shaper_attach(struct shaper *s, const char *path)
+{
+	int i;
+
+	s->path = NULL;
+	while (*path == '/')
+		path++;
+
+	for (i = 0; i < config.path_rates; i++) {
+		const char *prefix = config.path_rate[i].prefix;
+
+		if (strncmp(path, prefix, strlen(prefix)) == 0) {
+			s->path = &paths[i];
+			return;
+		}
+	}
+}
+
+size_t shaper_budget(struct shaper *s, size_t quantum)
+{
+	uint64_t now, budget = quantum;
+
+	if (!active)
+		return quantum;
+
+	now = stats_now_ns();
+	budget = min_u64(budget, token_bucket_refill(&s->own, now));
+	if (s->path != NULL)
+		budget = min_u64(budget, token_bucket_refill(s->path, now));
+	budget = min_u64(budget, token_bucket_refill(&global, now));
+
+	return budget;
+}
+
+unsigned int shaper_delay(const struct shaper *s, uint64_t left)
+{
+	/* waking for a few bytes would only make turns and wakeups */
+	uint64_t want = left > 0 ? min_u64(left, AWS_SHAPER_MIN_BURST) : 1;
+	unsigned int ms = token_bucket_delay(&s->own, want), path = 0, all;
+
+	if (s->path != NULL)
+		path = token_bucket_delay(s->path, want);
+	all = token_bucket_delay(&global, want);
+
+	if (path > ms)
+		ms = path;
+
+	return all > ms ? all : ms;
+}
+
+static void bucket_charge(struct token_bucket *b, size_t bytes)
+{
+	if (b->rate > 0)
+		b->tokens -= min_u64(b->tokens, bytes);
+}
+
+void shaper_charge(struct shaper *s, size_t bytes)
+{
+	if (!active)
+		return;
+
+	bucket_charge(&s->own, bytes);
+	if (s->path != NULL)
+		bucket_charge(s->path, bytes);
+	bucket_charge(&global, bytes);
+}
+
+void shaper_throttled(void)
+{
+	stats.throttled++;
+}
+
+void shaper_stats_dump(FILE *f)
+{
+	int i;
+
+	if (!active)
+		return;
+
+	fprintf(f, "shaper: rate_limit=%zu global_rate=%zu throttled=%llu",
+			config.rate_limit, config.global_rate, stats.throttled);
+	for (i = 0; i < config.path_rates; i++)
+		fprintf(f, " %s=%zu", config.path_rate[i].prefix,
+				config.path_rate[i].rate);
+	fprintf(f, "\n");
+}
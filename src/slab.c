@@ -0,0 +1,78 @@
+/*
+ * Asynchronous Web Server - slab allocator for fixed-size objects
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../headers/util.h"
+#include "../headers/slab.h"
+
+void slab_cache_init(struct slab_cache *c, const char *name, size_t size,
+		size_t align, size_t per_slab)
+{
+	c->name = name;
+	c->size = (size + align - 1) / align * align;
+	if (c->size < sizeof(void *))
+		c->size = sizeof(void *);
+	c->per_slab = per_slab > 0 ? per_slab : 1;
+	c->free = NULL;
+	c->slabs = c->in_use = c->high_water = 0;
+}
+
+/*
+ * Map one more slab and thread its objects onto the free list.
+ */
+static int slab_grow(struct slab_cache *c)
+{
+	char *mem;
+	size_t i;
+
+	mem = mmap(NULL, c->size * c->per_slab, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		ERR("mmap");
+		return -1;
+	}
+
+	for (i = c->per_slab; i > 0; i--) {
+		void **obj = (void **) (mem + (i - 1) * c->size);
+
+		*obj = c->free;
+		c->free = obj;
+	}
+	c->slabs++;
+
+	return 0;
+}
+
+void *slab_alloc(struct slab_cache *c)
+{
+	void **obj;
+
+	if (c->free == NULL && slab_grow(c) < 0)
+		return NULL;
+
+	obj = c->free;
+	c->free = *obj;
+	if (++c->in_use > c->high_water)
+		c->high_water = c->in_use;
+
+	return obj;
+}
+
+void slab_free(struct slab_cache *c, void *obj)
+{
+	*(void **) obj = c->free;
+	c->free = obj;
+	c->in_use--;
+}
+
+void slab_cache_dump(FILE *f, const struct slab_cache *c)
+{
+	fprintf(f, "slab %s: object=%zu in_use=%zu high_water=%zu slabs=%zu "
+			"reserved=%zu\n", c->name, c->size, c->in_use,
+			c->high_water, c->slabs, c->slabs * c->per_slab * c->size);
+}
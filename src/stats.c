@@ -0,0 +1,65 @@
+/*
+ * Asynchronous Web Server - counters and latency histograms
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../headers/stats.h"
+
+void hist_add(struct histogram *h, uint64_t usec)
+{
+	int i = 0;
+
+	while (i < HIST_BUCKETS - 1 && (usec >> (i + 1)) != 0)
+		i++;
+
+	h->bucket[i]++;
+	h->count++;
+	h->sum += usec;
+	if (usec > h->max)
+		h->max = usec;
+}
+
+/*
+ * Upper bound (in microseconds) of the bucket holding the p-th percentile.
+ */
+uint64_t hist_percentile(const struct histogram *h, double p)
+{
+	unsigned long long seen = 0, rank;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (unsigned long long) (p * h->count);
+	if (rank >= h->count)
+		rank = h->count - 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > rank)
+			break;
+	}
+
+	if (i >= HIST_BUCKETS - 1)
+		return h->max;
+	return (2ULL << i) < h->max ? (2ULL << i) : h->max;
+}
+
+void hist_dump(FILE *f, const char *name, const struct histogram *h)
+{
+	int i;
+
+	fprintf(f, "%s: n=%llu avg=%lluus p50<=%lluus p99<=%lluus max=%lluus\n",
+			name, h->count, h->count ? h->sum / h->count : 0,
+			(unsigned long long) hist_percentile(h, 0.50),
+			(unsigned long long) hist_percentile(h, 0.99),
+			h->max);
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if (h->bucket[i] != 0)
+			fprintf(f, "\t[%10lluus, %10lluus) %llu\n",
+					i == 0 ? 0ULL : 1ULL << i, 2ULL << i,
+					h->bucket[i]);
+}
@@ -0,0 +1,266 @@
+/*
+ * Asynchronous Web Server - connection timeouts
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "../headers/util.h"
+#include "../headers/aws.h"
+#include "../headers/stats.h"
+#include "../headers/timer_wheel.h"
+
+#define TIMER_MASK		(TIMER_SLOTS - 1)
+/* furthest a timer may be armed, in ticks */
+#define TIMER_MAX_TICKS		((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+/* set in expires of precise timers, far above any tick or deadline */
+#define TIMER_PRECISE		(1ULL << 63)
+#define TICK_NS			(AWS_TIMER_TICK_MS * 1000000ULL)
+
+static struct timer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+/* precise timers, earliest deadline first */
+static struct timer *precise;
+static struct timer *precise_tail;
+
+/* next tick to run, and the timers waiting for one */
+static uint64_t now;
+static unsigned long pending;
+static int timerfd;
+
+static uint64_t clock_ticks(void)
+{
+	return stats_now_ns() / TICK_NS;
+}
+
+/*
+ * The timerfd ticks on the tick boundaries of the clock while the wheel
+ * holds timers, and goes off in between for the first precise timer.
+ */
+static void timerfd_update(void)
+{
+	struct itimerspec its;
+	uint64_t now_ns = stats_now_ns(), wait = 0, at;
+	int rc;
+
+	memset(&its, 0, sizeof(its));
+	if (pending > 0) {
+		its.it_interval.tv_nsec = TICK_NS;
+		wait = TICK_NS - now_ns % TICK_NS;
+	}
+	if (precise != NULL) {
+		at = precise->expires & ~TIMER_PRECISE;
+		/* 0 would disarm it: a deadline gone by fires right away */
+		at = at > now_ns ? at - now_ns : 1;
+		if (wait == 0 || at < wait)
+			wait = at;
+	}
+	its.it_value.tv_sec = wait / 1000000000ULL;
+	its.it_value.tv_nsec = wait % 1000000000ULL;
+
+	rc = timerfd_settime(timerfd, 0, &its, NULL);
+	DIE(rc < 0, "timerfd_settime");
+}
+
+static void list_add(struct timer **head, struct timer *t)
+{
+	t->next = *head;
+	if (t->next != NULL)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+static void list_del(struct timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next != NULL)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/* next is the first member: a link other than the head is in the timer before */
+static struct timer *precise_prev(struct timer *t)
+{
+	return t->pprev == &precise ? NULL : (struct timer *) t->pprev;
+}
+
+static void precise_add(struct timer *t)
+{
+	struct timer *p = precise_tail;
+
+	while (p != NULL && p->expires > t->expires)
+		p = precise_prev(p);
+
+	list_add(p != NULL ? &p->next : &precise, t);
+	if (t->next == NULL)
+		precise_tail = t;
+}
+
+static void precise_del(struct timer *t)
+{
+	if (precise_tail == t)
+		precise_tail = precise_prev(t);
+	list_del(t);
+}
+
+/* Fire the precise timers whose deadline has come */
+static void precise_run(void)
+{
+	uint64_t now_ns = stats_now_ns() | TIMER_PRECISE;
+
+	while (precise != NULL && precise->expires <= now_ns) {
+		struct timer *t = precise;
+
+		precise_del(t);
+		t->fire(t);
+	}
+}
+
+/* Slot of the lowest level whose span reaches t->expires */
+static void wheel_add(struct timer *t)
+{
+	uint64_t delta;
+	int level;
+
+	if (t->expires < now)
+		t->expires = now;
+	delta = t->expires - now;
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < 1ULL << ((level + 1) * TIMER_SLOT_BITS))
+			break;
+
+	list_add(&wheel[level][(t->expires >> (level * TIMER_SLOT_BITS)) &
+			TIMER_MASK], t);
+}
+
+/*
+ * Hand the timers of the current slot of level down to the levels below.
+ * Returns the slot index, 0 when level above must cascade as well.
+ */
+static int cascade(int level)
+{
+	int idx = (now >> (level * TIMER_SLOT_BITS)) & TIMER_MASK;
+	struct timer *t = wheel[level][idx];
+
+	wheel[level][idx] = NULL;
+	while (t != NULL) {
+		struct timer *next = t->next;
+
+		wheel_add(t);
+		t = next;
+	}
+
+	return idx;
+}
+
+static void wheel_tick(void)
+{
+	int idx = now & TIMER_MASK, level;
+	struct timer *list;
+
+	for (level = 1; idx == 0 && level < TIMER_LEVELS; level++)
+		idx = cascade(level);
+
+	/* detach the slot: what fires may re-arm into it */
+	list = wheel[0][now & TIMER_MASK];
+	wheel[0][now & TIMER_MASK] = NULL;
+	if (list != NULL)
+		list->pprev = &list;
+	now++;
+
+	while (list != NULL) {
+		struct timer *t = list;
+
+		list_del(t);
+		pending--;
+		t->fire(t);
+	}
+}
+
+int timer_wheel_init(void)
+{
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	DIE(timerfd < 0, "timerfd_create");
+
+	now = clock_ticks();
+
+	return timerfd;
+}
+
+void timer_wheel_run(void)
+{
+	uint64_t expirations, target = clock_ticks();
+
+	/* how often it ticked does not matter, the clock says where we are */
+	if (read(timerfd, &expirations, sizeof(expirations)) < 0 &&
+			errno != EAGAIN)
+		ERR("read timerfd");
+
+	while (pending > 0 && now <= target)
+		wheel_tick();
+	precise_run();
+
+	if (pending == 0)
+		now = target + 1;
+	timerfd_update();
+}
+
+void timer_init(struct timer *t, void (*fire)(struct timer *t))
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->fire = fire;
+}
+
+void timer_arm(struct timer *t, unsigned int ms)
+{
+	uint64_t ticks = (ms + AWS_TIMER_TICK_MS - 1) / AWS_TIMER_TICK_MS;
+
+	if (timer_pending(t))
+		timer_cancel(t);
+
+	/* an idle wheel has not followed the clock */
+	if (pending++ == 0) {
+		now = clock_ticks();
+		timerfd_update();
+	}
+
+	if (ticks > TIMER_MAX_TICKS - 1)
+		ticks = TIMER_MAX_TICKS - 1;
+	/* from the clock, the wheel may lag it; the current tick is partly gone */
+	t->expires = clock_ticks() + ticks + 1;
+	wheel_add(t);
+}
+
+void timer_arm_precise(struct timer *t, unsigned int ms)
+{
+	if (timer_pending(t))
+		timer_cancel(t);
+
+	t->expires = (stats_now_ns() + ms * 1000000ULL) | TIMER_PRECISE;
+	precise_add(t);
+	if (precise == t)
+		timerfd_update();
+}
+
+void timer_cancel(struct timer *t)
+{
+	if (!timer_pending(t))
+		return;
+
+	/* a precise timer left first only makes the timerfd go off early */
+	if (t->expires & TIMER_PRECISE) {
+		precise_del(t);
+		return;
+	}
+
+	list_del(t);
+	pending--;
+}
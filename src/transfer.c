@@ -0,0 +1,1560 @@
+/*
+ * Asynchronous Web Server - transfer strategies
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
+#include <libaio.h>
+
+#include "../headers/util.h"
+#include "../headers/debug.h"
+#include "../headers/aws.h"
+#include "../headers/config.h"
+#include "../headers/transfer.h"
+#include "../headers/block_cache.h"
+#include "../headers/io_buffer.h"
+#include "../headers/gzip_cache.h"
+#include "../headers/chunked.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY		60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY		0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY	5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+enum chunk_state {
+	CHUNK_FREE,
+	CHUNK_READING,
+	CHUNK_READY,
+	CHUNK_ERROR,
+	/* sent with MSG_ZEROCOPY, the kernel still reads the buffer */
+	CHUNK_SENT
+};
+
+/* One slot of the per-connection AIO read window */
+struct aio_chunk {
+	struct aio_op op;
+	struct block_waiter wait;
+	struct connection *conn;
+	char *buf;
+	/* either buf or the data of a shared cache block */
+	char *data;
+	struct cache_block *block;
+	size_t len;
+	size_t sent;
+	enum chunk_state state;
+	/* chunks covered by the read this one leads */
+	int nr;
+	/* id of the last MSG_ZEROCOPY send that covered the chunk */
+	uint32_t zc_id;
+};
+
+static struct transfer_hooks hooks;
+static struct transfer_stats stats[TRANSFER_KINDS];
+
+/* Shared AIO context; completions are signalled on aio_efd */
+static io_context_t aio_ctx;
+static int aio_efd = -1;
+static int aio_usable;
+
+/* Idle pipes kept around for the splice engine */
+static int pipe_pool[AWS_PIPE_POOL][2];
+static int pipe_pool_count;
+
+/* io_submit() calls that took too long during the current probe */
+static int aio_auto;
+static int aio_slow;
+static int aio_samples;
+static unsigned long long aio_slow_total;
+
+/* MSG_ZEROCOPY sends, completions and completions that fell back to a copy */
+static unsigned long long zc_sends;
+static unsigned long long zc_completions;
+static unsigned long long zc_copied;
+
+/* Disk read submissions (io_submit calls or pool jobs), reads and bytes */
+static unsigned long long aio_submits;
+static unsigned long long aio_reads;
+static unsigned long long aio_read_bytes;
+/* bytes of the reads submitted and not completed yet */
+static size_t aio_inflight;
+
+/* Engine serving dynamic files above config.medium_max */
+static int dynamic_large = TRANSFER_AIO;
+
+/* end of the file range sent as the body, or as the current part */
+static off_t body_end(const struct connection *conn)
+{
+	return conn->body_end;
+}
+
+/* File bytes the response carries, over every range */
+static off_t body_length(const struct connection *conn)
+{
+	off_t len = 0;
+	int i;
+
+	if (conn->nranges == 0)
+		return conn->st.st_size;
+	for (i = 0; i < conn->nranges; i++)
+		len += conn->ranges[i].end - conn->ranges[i].start;
+
+	return len;
+}
+
+/* File bytes sent so far, finished parts included */
+static off_t body_sent(const struct connection *conn)
+{
+	off_t sent = 0;
+	int i;
+
+	for (i = 0; i < conn->range_next; i++)
+		sent += conn->ranges[i].end - conn->ranges[i].start;
+	if (conn->nranges > 0 && conn->range_next == conn->nranges)
+		return sent;
+
+	return sent + conn->file_pos - conn->body_start;
+}
+
+/* Caps len at what the current send turn has left */
+static size_t turn_cap(const struct connection *conn, size_t len)
+{
+	return len < conn->turn_left ? len : conn->turn_left;
+}
+
+static void count_syscall(const struct connection *conn)
+{
+	if (conn->engine >= 0)
+		stats[conn->engine].syscalls++;
+}
+
+/*
+ * Send what is left of the header and the body pieces in one call.
+ * Returns the number of body bytes sent, -1 with errno on error.
+ */
+static ssize_t send_gather(struct connection *conn, const struct iovec *body,
+		int count, int flags)
+{
+	struct iovec iov[AWS_SEND_IOV + 1];
+	struct msghdr msg;
+	size_t head = conn->send_len - conn->send_pos;
+	size_t left = conn->turn_left;
+	ssize_t rc;
+	int n = 0, i;
+
+	if (head > 0) {
+		iov[n].iov_base = conn->send_buffer + conn->send_pos;
+		iov[n++].iov_len = head;
+	}
+	/* the body as far as the turn goes */
+	for (i = 0; i < count && i < AWS_SEND_IOV && left > 0; i++) {
+		iov[n] = body[i];
+		if (iov[n].iov_len > left)
+			iov[n].iov_len = left;
+		left -= iov[n++].iov_len;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+
+	rc = sendmsg(conn->sockfd, &msg, flags | MSG_NOSIGNAL);
+	count_syscall(conn);
+	if (rc < 0)
+		return -1;
+
+	if ((size_t) rc <= head) {
+		conn->send_pos += rc;
+		return 0;
+	}
+	conn->send_pos = conn->send_len;
+	conn->turn_left -= rc - head;
+
+	return rc - head;
+}
+
+enum transfer_status transfer_send_header(struct connection *conn, int more)
+{
+	while (conn->send_pos < conn->send_len)
+		if (send_gather(conn, NULL, 0, more ? MSG_MORE : 0) < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+
+	return TRANSFER_DONE;
+}
+
+/*
+ * inline: body follows the header in send_buffer.
+ */
+static int inline_start(struct connection *conn)
+{
+	off_t size = body_end(conn);
+	ssize_t rc;
+
+	if (conn->send_len + (size - conn->file_pos) > BUFSIZ)
+		return -1;
+
+	while (conn->file_pos < size) {
+		rc = pread(conn->fd, conn->send_buffer + conn->send_len,
+				size - conn->file_pos, conn->file_pos);
+		if (rc <= 0)
+			return -1;
+		conn->send_len += rc;
+		conn->file_pos += rc;
+	}
+
+	return 0;
+}
+
+static enum transfer_status inline_send(struct connection *conn)
+{
+	return transfer_send_header(conn, 0);
+}
+
+static void inline_finish(struct connection *conn)
+{
+}
+
+/*
+ * sendfile: zero-copy from the page cache to the socket.
+ */
+static int sendfile_start(struct connection *conn)
+{
+	return 0;
+}
+
+static enum transfer_status sendfile_send(struct connection *conn)
+{
+	enum transfer_status status;
+	off_t size = body_end(conn);
+	ssize_t rc;
+
+	/* Corked: the header goes out with the first sendfile() segment */
+	status = transfer_send_header(conn, 1);
+	if (status != TRANSFER_DONE)
+		return status;
+
+	while (conn->file_pos < size) {
+		if (conn->turn_left == 0)
+			return TRANSFER_YIELD;
+		rc = sendfile(conn->sockfd, conn->fd, &conn->file_pos,
+				turn_cap(conn, size - conn->file_pos));
+		count_syscall(conn);
+		if (rc < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+		if (rc == 0)
+			return TRANSFER_ERROR;
+		conn->turn_left -= rc;
+	}
+
+	return TRANSFER_DONE;
+}
+
+static void sendfile_finish(struct connection *conn)
+{
+}
+
+/*
+ * mmap: send straight out of a read-only mapping of the file.
+ */
+static int mmap_start(struct connection *conn)
+{
+	void *map;
+
+	/* the whole file, every range is sent out of the one mapping */
+	map = mmap(NULL, conn->st.st_size, PROT_READ, MAP_SHARED, conn->fd, 0);
+	if (map == MAP_FAILED) {
+		ERR("mmap");
+		return -1;
+	}
+	madvise(map, conn->st.st_size, MADV_SEQUENTIAL);
+	conn->map = map;
+
+	return 0;
+}
+
+static enum transfer_status mmap_send(struct connection *conn)
+{
+	off_t size = body_end(conn);
+	ssize_t rc;
+
+	while (conn->file_pos < size) {
+		struct iovec body = {
+			conn->map + conn->file_pos, size - conn->file_pos
+		};
+
+		if (conn->turn_left == 0)
+			return TRANSFER_YIELD;
+
+		rc = send_gather(conn, &body, 1, 0);
+		if (rc < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+		conn->file_pos += rc;
+	}
+
+	return TRANSFER_DONE;
+}
+
+static void mmap_finish(struct connection *conn)
+{
+	if (conn->map != NULL)
+		munmap(conn->map, conn->st.st_size);
+	conn->map = NULL;
+}
+
+/*
+ * aio: keep config.aio_window chunks in flight and send them in order.
+ * The window is split into groups of config.aio_vector chunks; a group is
+ * read by one IOCB_CMD_PREADV once all of its chunks were sent, and every
+ * group ready at the same time goes out in one io_submit().
+ */
+static struct iovec *chunk_iov(const struct connection *conn)
+{
+	return (struct iovec *) (conn->chunks + config.aio_window);
+}
+
+static void chunk_done(struct aio_chunk *c, int ok)
+{
+	struct connection *conn = c->conn;
+	int i;
+
+	conn->inflight--;
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		if (conn->inflight == 0)
+			hooks.release(conn);
+		return;
+	}
+
+	for (i = 0; i < c->nr; i++)
+		c[i].state = ok ? CHUNK_READY : CHUNK_ERROR;
+	if (hooks.wakeup != NULL)
+		hooks.wakeup(conn);
+}
+
+/* bytes covered by the read of leader chunk c */
+static size_t group_len(const struct aio_chunk *c)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < c->nr; i++)
+		len += c[i].len;
+
+	return len;
+}
+
+static void chunk_complete(struct aio_op *op, long res)
+{
+	struct aio_chunk *c = (struct aio_chunk *) op;
+
+	chunk_done(c, res == (long) group_len(c));
+}
+
+static void chunk_block_ready(struct block_waiter *w, int ok)
+{
+	struct aio_chunk *c = (struct aio_chunk *)
+		((char *) w - offsetof(struct aio_chunk, wait));
+
+	chunk_done(c, ok);
+}
+
+/*
+ * O_DIRECT and coalesced reads land in the shared block cache, one block
+ * per chunk. Returns 1 if the chunk was served from there.
+ */
+static int aio_cached_chunk(struct connection *conn, struct aio_chunk *c)
+{
+	/* a range may start inside a block, the chunk then ends with it */
+	off_t offset = conn->read_pos & ~((off_t) AWS_BLOCK_SIZE - 1);
+	off_t end = offset + AWS_BLOCK_SIZE;
+	struct cache_block *b;
+
+	b = block_cache_get(&conn->st,
+			conn->direct_fd >= 0 ? conn->direct_fd : conn->fd,
+			offset, &c->wait);
+	if (b == NULL)
+		return 0;
+
+	c->block = b;
+	c->data = b->buf + (conn->read_pos - offset);
+	c->len = (end < body_end(conn) ? end : body_end(conn)) - conn->read_pos;
+	c->nr = 1;
+	if (b->state == BLOCK_VALID) {
+		c->state = CHUNK_READY;
+	} else {
+		c->state = CHUNK_READING;
+		conn->inflight++;
+	}
+	conn->read_pos += c->len;
+
+	return 1;
+}
+
+/*
+ * Set up the chunks of the group at index g for the next file range.
+ * Returns the read to submit, NULL if the block cache took care of it.
+ */
+static struct aio_op *aio_prep_group(struct connection *conn, int g)
+{
+	struct iovec *iov = chunk_iov(conn);
+	struct aio_chunk *c = &conn->chunks[g];
+	off_t size = body_end(conn), pos = conn->read_pos;
+	int i;
+
+	for (i = 0; i < config.aio_vector && pos < size; i++) {
+		c[i].len = size - pos > config.chunk_size ?
+			config.chunk_size : size - pos;
+		c[i].sent = 0;
+		c[i].data = c[i].buf;
+		c[i].state = CHUNK_READING;
+		iov[g + i].iov_base = c[i].buf;
+		iov[g + i].iov_len = c[i].len;
+		pos += c[i].len;
+	}
+
+	if ((conn->direct_fd >= 0 || config.coalesce) && aio_cached_chunk(conn, c))
+		return NULL;
+
+	c->nr = i;
+	io_prep_preadv(&c->op.iocb, conn->fd, &iov[g], i, conn->read_pos);
+	conn->read_pos = pos;
+
+	return &c->op;
+}
+
+/*
+ * Queue the prepared reads; whatever the context refuses is read inline.
+ */
+static int aio_submit_groups(struct connection *conn, struct aio_op **ops, int n)
+{
+	int submitted, i;
+
+	submitted = transfer_aio_submit_batch(ops, n);
+	conn->inflight += submitted;
+
+	for (i = submitted; i < n; i++) {
+		struct aio_chunk *c = (struct aio_chunk *) ops[i];
+		struct iocb *iocb = &ops[i]->iocb;
+		int j;
+
+		if (preadv(conn->fd, iocb->u.v.vec, iocb->u.v.nr,
+				iocb->u.v.offset) != (ssize_t) group_len(c))
+			return -1;
+		for (j = 0; j < c->nr; j++)
+			c[j].state = CHUNK_READY;
+	}
+
+	return 0;
+}
+
+static int group_free(const struct connection *conn, int g)
+{
+	int i;
+
+	for (i = 0; i < config.aio_vector; i++)
+		if (conn->chunks[g + i].state != CHUNK_FREE)
+			return 0;
+
+	return 1;
+}
+
+static int aio_fill(struct connection *conn)
+{
+	struct aio_op *ops[AWS_AIO_BATCH];
+	int groups = config.aio_window / config.aio_vector;
+	int first = conn->chunk_head / config.aio_vector;
+	int i, n = 0;
+
+	for (i = 0; i < groups; i++) {
+		int g = (first + i) % groups * config.aio_vector;
+
+		if (conn->read_pos >= body_end(conn))
+			break;
+		if (!group_free(conn, g))
+			continue;
+
+		ops[n] = aio_prep_group(conn, g);
+		if (ops[n] != NULL && ++n == AWS_AIO_BATCH) {
+			if (aio_submit_groups(conn, ops, n) < 0)
+				return -1;
+			n = 0;
+		}
+	}
+
+	return n > 0 ? aio_submit_groups(conn, ops, n) : 0;
+}
+
+static void chunk_release(struct aio_chunk *c)
+{
+	if (c->block != NULL) {
+		block_cache_put(c->block);
+		c->block = NULL;
+	}
+	c->state = CHUNK_FREE;
+}
+
+/*
+ * Drain MSG_ZEROCOPY notifications from the socket error queue and free
+ * the chunks the kernel no longer reads. TCP completes sends in order,
+ * so every notification moves zc_done forward.
+ */
+static void zc_reap(struct connection *conn)
+{
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	int i;
+
+	while (conn->zc_done != conn->zc_sent) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(conn->sockfd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			zc_completions += serr->ee_data - serr->ee_info + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zc_copied += serr->ee_data - serr->ee_info + 1;
+			conn->zc_done = serr->ee_data + 1;
+		}
+	}
+
+	for (i = 0; i < config.aio_window; i++) {
+		struct aio_chunk *c = &conn->chunks[i];
+
+		if (c->state == CHUNK_SENT && (int32_t) (c->zc_id - conn->zc_done) < 0)
+			chunk_release(c);
+	}
+}
+
+/*
+ * Nothing to do until the kernel confirms zerocopy sends, which raises
+ * EPOLLERR on the socket. A real socket error raises it as well.
+ */
+static enum transfer_status zc_wait(struct connection *conn)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		return TRANSFER_ERROR;
+
+	return TRANSFER_WAIT;
+}
+
+static int aio_start(struct connection *conn)
+{
+	int one = 1;
+	int i;
+
+	/* the read vectors follow the chunks */
+	conn->chunks = arena_alloc(&conn->arena, config.aio_window *
+			(sizeof(*conn->chunks) + sizeof(struct iovec)));
+	if (conn->chunks == NULL)
+		return -1;
+	memset(conn->chunks, 0, config.aio_window * sizeof(*conn->chunks));
+
+	conn->direct_fd = -1;
+	if (config.direct) {
+		conn->direct_fd = open(conn->pathname, O_RDONLY | O_DIRECT);
+		if (conn->direct_fd < 0)
+			dlog(LOG_WARNING, "%s: no O_DIRECT, using buffered reads\n",
+					conn->pathname);
+	}
+
+	for (i = 0; i < config.aio_window; i++) {
+		conn->chunks[i].conn = conn;
+		conn->chunks[i].op.complete = chunk_complete;
+		conn->chunks[i].wait.ready = chunk_block_ready;
+		conn->chunks[i].buf = io_buffer_get(config.chunk_size);
+		if (conn->chunks[i].buf == NULL)
+			return -1;
+	}
+
+	conn->chunk_head = 0;
+	conn->read_pos = conn->file_pos;
+
+	conn->zerocopy = config.zerocopy &&
+		setsockopt(conn->sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+	conn->zc_sent = conn->zc_done = 0;
+
+	return aio_fill(conn);
+}
+
+static enum transfer_status aio_send(struct connection *conn)
+{
+	struct iovec iov[AWS_SEND_IOV];
+	size_t send_pos;
+	uint32_t zc_id = 0;
+	ssize_t rc;
+	int n;
+
+	if (conn->zerocopy && conn->zc_done != conn->zc_sent) {
+		zc_reap(conn);
+		if (aio_fill(conn) < 0)
+			return TRANSFER_ERROR;
+	}
+
+	while (conn->file_pos < body_end(conn)) {
+		struct aio_chunk *c = &conn->chunks[conn->chunk_head];
+
+		switch (c->state) {
+		case CHUNK_READING:
+			return TRANSFER_WAIT;
+		case CHUNK_SENT:
+			/* the whole window is still owned by the kernel */
+			return zc_wait(conn);
+		case CHUNK_ERROR:
+			return TRANSFER_ERROR;
+		case CHUNK_FREE:
+			if (aio_fill(conn) < 0)
+				return TRANSFER_ERROR;
+			/* sent in pieces, the rest of its group is still the kernel's */
+			if (c->state == CHUNK_FREE)
+				return conn->zerocopy ? zc_wait(conn) : TRANSFER_ERROR;
+			continue;
+		case CHUNK_READY:
+			break;
+		}
+		if (conn->turn_left == 0)
+			return TRANSFER_YIELD;
+
+		/* Every ready chunk from the head on goes out in one call */
+		for (n = 0; n < config.aio_window && n < AWS_SEND_IOV; n++) {
+			struct aio_chunk *d = &conn->chunks[(conn->chunk_head + n) %
+				config.aio_window];
+
+			if (d->state != CHUNK_READY)
+				break;
+			iov[n].iov_base = d->data + d->sent;
+			iov[n].iov_len = d->len - d->sent;
+		}
+
+		send_pos = conn->send_pos;
+		rc = send_gather(conn, iov, n, conn->zerocopy ? MSG_ZEROCOPY : 0);
+		if (rc < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+
+		/* Every send that moved data gets the next notification id */
+		if (conn->zerocopy && (rc > 0 || conn->send_pos != send_pos)) {
+			zc_id = conn->zc_sent++;
+			zc_sends++;
+		}
+
+		while (rc > 0) {
+			size_t take = c->len - c->sent;
+
+			if (take > (size_t) rc)
+				take = rc;
+			c->sent += take;
+			c->zc_id = zc_id;
+			conn->file_pos += take;
+			rc -= take;
+			if (c->sent < c->len)
+				break;
+
+			/* Chunk done, recycle it once the kernel is done with it */
+			if (conn->zerocopy)
+				c->state = CHUNK_SENT;
+			else
+				chunk_release(c);
+			conn->chunk_head = (conn->chunk_head + 1) % config.aio_window;
+			c = &conn->chunks[conn->chunk_head];
+		}
+
+		if (aio_fill(conn) < 0)
+			return TRANSFER_ERROR;
+	}
+
+	/* The buffers must outlive the sends, and so must the socket */
+	if (conn->zerocopy && conn->zc_done != conn->zc_sent)
+		return zc_wait(conn);
+
+	return TRANSFER_DONE;
+}
+
+static void aio_finish(struct connection *conn)
+{
+	int i;
+
+	if (conn->chunks == NULL)
+		return;
+
+	/*
+	 * After an error zerocopy sends may still be pending. The connection
+	 * is dead, so the kernel may read recycled buffers: it only sends
+	 * garbage to a peer that is gone.
+	 */
+	for (i = 0; i < config.aio_window; i++) {
+		if (conn->chunks[i].block != NULL)
+			block_cache_put(conn->chunks[i].block);
+		if (conn->chunks[i].buf != NULL)
+			io_buffer_put(conn->chunks[i].buf, config.chunk_size);
+	}
+	/* the window itself goes away with the request arena */
+	conn->chunks = NULL;
+
+	if (conn->direct_fd >= 0)
+		close(conn->direct_fd);
+	conn->direct_fd = -1;
+}
+
+/*
+ * splice: file -> pipe -> socket, the data never reaches user space.
+ */
+static int splice_start(struct connection *conn)
+{
+	if (pipe_pool_count > 0) {
+		pipe_pool_count--;
+		conn->pipefd[0] = pipe_pool[pipe_pool_count][0];
+		conn->pipefd[1] = pipe_pool[pipe_pool_count][1];
+	} else {
+		if (pipe2(conn->pipefd, O_NONBLOCK | O_CLOEXEC) < 0) {
+			ERR("pipe2");
+			conn->pipefd[0] = conn->pipefd[1] = -1;
+			return -1;
+		}
+		/* A larger pipe means fewer splice() round trips */
+		fcntl(conn->pipefd[1], F_SETPIPE_SZ, AWS_PIPE_SIZE);
+	}
+
+	conn->pipe_len = 0;
+	conn->read_pos = conn->file_pos;
+
+	return 0;
+}
+
+static enum transfer_status splice_send(struct connection *conn)
+{
+	enum transfer_status status;
+	off_t size = body_end(conn);
+	ssize_t rc;
+
+	status = transfer_send_header(conn, 1);
+	if (status != TRANSFER_DONE)
+		return status;
+
+	while (conn->file_pos < size) {
+		/* Top up the pipe; EAGAIN just means it is full */
+		if (conn->read_pos < size) {
+			rc = splice(conn->fd, &conn->read_pos, conn->pipefd[1], NULL,
+					size - conn->read_pos,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			count_syscall(conn);
+			if (rc < 0 && errno != EAGAIN)
+				return TRANSFER_ERROR;
+			if (rc == 0)
+				return TRANSFER_ERROR;
+			if (rc > 0)
+				conn->pipe_len += rc;
+		}
+
+		if (conn->turn_left == 0)
+			return TRANSFER_YIELD;
+		rc = splice(conn->pipefd[0], NULL, conn->sockfd, NULL,
+				turn_cap(conn, conn->pipe_len),
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		count_syscall(conn);
+		if (rc < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+
+		conn->pipe_len -= rc;
+		conn->file_pos += rc;
+		conn->turn_left -= rc;
+	}
+
+	return TRANSFER_DONE;
+}
+
+static void splice_finish(struct connection *conn)
+{
+	if (conn->pipefd[0] < 0)
+		return;
+
+	/* Only drained pipes can be handed to the next connection */
+	if (conn->pipe_len == 0 && pipe_pool_count < AWS_PIPE_POOL) {
+		pipe_pool[pipe_pool_count][0] = conn->pipefd[0];
+		pipe_pool[pipe_pool_count][1] = conn->pipefd[1];
+		pipe_pool_count++;
+	} else {
+		close(conn->pipefd[0]);
+		close(conn->pipefd[1]);
+	}
+	conn->pipefd[0] = conn->pipefd[1] = -1;
+}
+
+/*
+ * gzip: send the compressed output of the file from gzip_cache.h. HTTP/1.1
+ * clients get it chunked (chunked.h); HTTP/1.0 ones get the bare data and
+ * the end of the body is the end of the connection.
+ */
+static void gzip_ready(struct gzip_waiter *w)
+{
+	struct connection *conn = (struct connection *)
+		((char *) w - offsetof(struct connection, gz_wait));
+
+	conn->inflight--;
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		if (conn->inflight == 0)
+			hooks.release(conn);
+		return;
+	}
+
+	if (hooks.wakeup != NULL)
+		hooks.wakeup(conn);
+}
+
+static int gzip_start(struct connection *conn)
+{
+	conn->encoder = NULL;
+	if (conn->chunked) {
+		conn->encoder = arena_alloc(&conn->arena, sizeof(*conn->encoder));
+		if (conn->encoder == NULL)
+			return -1;
+		chunked_init(conn->encoder, config.http_chunk);
+	}
+
+	conn->gzip = gzip_cache_get(conn->fd, &conn->st, conn->encoding);
+	if (conn->gzip == NULL)
+		return -1;
+
+	conn->gz_sent = NULL;
+	conn->gz_off = 0;
+	conn->gz_wait.ready = gzip_ready;
+	conn->gz_wait.queued = 0;
+
+	return 0;
+}
+
+static struct gzip_segment *gzip_next(const struct connection *conn)
+{
+	return conn->gz_sent != NULL ? conn->gz_sent->next : conn->gzip->head;
+}
+
+/* Output ready to go, from the first byte not sent yet */
+static int gzip_iov(const struct connection *conn, struct iovec *iov)
+{
+	const struct gzip_segment *s;
+	int n = 0;
+
+	for (s = gzip_next(conn); s != NULL && n < AWS_SEND_IOV; s = s->next) {
+		size_t skip = n == 0 ? conn->gz_off : 0;
+
+		iov[n].iov_base = (char *) s->data + skip;
+		iov[n++].iov_len = s->len - skip;
+	}
+
+	return n;
+}
+
+/* Account sent output to the segments it came from */
+static void gzip_advance(struct connection *conn, size_t sent)
+{
+	struct gzip_segment *s;
+
+	for (s = gzip_next(conn); s != NULL && sent > 0; s = s->next) {
+		size_t left = s->len - conn->gz_off;
+
+		if (sent < left) {
+			conn->gz_off += sent;
+			return;
+		}
+		sent -= left;
+		conn->gz_off = 0;
+		conn->gz_sent = s;
+	}
+}
+
+/*
+ * The chunked body is complete: queue the last chunk, with the trailers
+ * the client takes, behind whatever is left in send_buffer.
+ */
+static void gzip_last_chunk(struct connection *conn)
+{
+	char trailers[64] = "";
+
+	if (conn->trailers)
+		snprintf(trailers, sizeof(trailers),
+				"Server-Timing: total;dur=%.3f\r\n",
+				(stats_now_ns() - conn->start_ns) / 1e6);
+
+	if (conn->send_pos == conn->send_len)
+		conn->send_pos = conn->send_len = 0;
+	conn->send_len += chunked_end(conn->send_buffer + conn->send_len,
+			BUFSIZ - conn->send_len, trailers);
+	conn->encoder->ended = 1;
+}
+
+static enum transfer_status gzip_send(struct connection *conn)
+{
+	struct gzip_entry *e = conn->gzip;
+	struct iovec body[AWS_SEND_IOV], framed[AWS_SEND_IOV], *iov = body;
+	ssize_t rc;
+	int n;
+
+	for (;;) {
+		n = gzip_iov(conn, body);
+		if (conn->encoder != NULL) {
+			n = chunked_frame(conn->encoder, body, n, framed, AWS_SEND_IOV);
+			iov = framed;
+		}
+
+		if (n == 0) {
+			if (e->state == GZIP_FAILED)
+				return TRANSFER_ERROR;
+			if (e->state == GZIP_RUNNING) {
+				/* caught up with the compressor, once */
+				if (gzip_cache_wait(e, &conn->gz_wait))
+					conn->inflight++;
+				return TRANSFER_WAIT;
+			}
+			if (conn->encoder != NULL && !conn->encoder->ended)
+				gzip_last_chunk(conn);
+			return transfer_send_header(conn, 0);
+		}
+		if (conn->turn_left == 0)
+			return TRANSFER_YIELD;
+
+		rc = send_gather(conn, iov, n, 0);
+		if (rc < 0)
+			return errno == EAGAIN ? TRANSFER_AGAIN : TRANSFER_ERROR;
+		/* progress and the turn count the gzip stream, not the framing */
+		if (conn->encoder != NULL) {
+			ssize_t wire = rc;
+
+			rc = chunked_sent(conn->encoder, wire);
+			conn->turn_left += wire - rc;
+		}
+		conn->file_pos += rc;
+		gzip_advance(conn, rc);
+	}
+}
+
+static void gzip_finish(struct connection *conn)
+{
+	if (conn->gzip != NULL)
+		gzip_cache_put(conn->gzip);
+	conn->gzip = NULL;
+	/* the encoder goes away with the request arena */
+	conn->encoder = NULL;
+}
+
+static const struct transfer_engine engines[TRANSFER_KINDS] = {
+	[TRANSFER_INLINE] = {
+		"inline", inline_start, inline_send, inline_finish
+	},
+	[TRANSFER_SENDFILE] = {
+		"sendfile", sendfile_start, sendfile_send, sendfile_finish
+	},
+	[TRANSFER_MMAP] = {
+		"mmap", mmap_start, mmap_send, mmap_finish
+	},
+	[TRANSFER_AIO] = {
+		"aio", aio_start, aio_send, aio_finish
+	},
+	[TRANSFER_SPLICE] = {
+		"splice", splice_start, splice_send, splice_finish
+	},
+	[TRANSFER_GZIP] = {
+		"gzip", gzip_start, gzip_send, gzip_finish
+	},
+};
+
+int transfer_init(const struct transfer_hooks *h)
+{
+	hooks = *h;
+
+	if (strcmp(config.dynamic_engine, engines[TRANSFER_SPLICE].name) == 0) {
+		dynamic_large = TRANSFER_SPLICE;
+	} else if (strcmp(config.dynamic_engine, engines[TRANSFER_AIO].name) != 0) {
+		fprintf(stderr, "unknown dynamic engine: %s\n", config.dynamic_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	io_buffer_init(config.huge_pages);
+
+	aio_efd = eventfd(0, EFD_NONBLOCK);
+	DIE(aio_efd < 0, "eventfd");
+
+	aio_usable = io_setup(AWS_AIO_MAX_EVENTS, &aio_ctx) == 0;
+
+	reader_pool_init(config.reader_threads, aio_efd);
+	if (strcmp(config.disk_engine, "threads") == 0 || !aio_usable) {
+		reader_pool_start();
+	} else if (strcmp(config.disk_engine, "auto") == 0) {
+		aio_auto = 1;
+	} else if (strcmp(config.disk_engine, "aio") != 0) {
+		fprintf(stderr, "unknown disk engine: %s\n", config.disk_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	if (config.direct || config.coalesce)
+		block_cache_init(config.block_cache);
+
+	/*
+	 * deflate runs on the reader threads, disk reads stay with aio;
+	 * without threads, responses go out uncompressed
+	 */
+	if (config.gzip_level > 0 && reader_pool_spawn() < 0) {
+		fprintf(stderr, "no reader threads, --gzip is off\n");
+		config.gzip_level = 0;
+	}
+	if (config.gzip_level > 0)
+		gzip_cache_init(config.gzip_cache, config.gzip_level);
+
+	return aio_efd;
+}
+
+static size_t iocb_bytes(const struct iocb *iocb)
+{
+	size_t len = 0;
+	int i;
+
+	if (iocb->aio_lio_opcode != IO_CMD_PREADV)
+		return iocb->u.c.nbytes;
+	for (i = 0; i < iocb->u.v.nr; i++)
+		len += iocb->u.v.vec[i].iov_len;
+
+	return len;
+}
+
+/* A reader thread ran the read of op: complete it as an aio event would */
+static void aio_op_pool_done(struct pool_job *job)
+{
+	struct aio_op *op = (struct aio_op *)
+		((char *) job - offsetof(struct aio_op, job));
+
+	aio_inflight -= iocb_bytes(&op->iocb);
+	op->complete(op, job->res);
+}
+
+/*
+ * Buffered io_submit() that copies from the page cache returns in
+ * microseconds; one that waits for the disk does not. When too many
+ * submissions of a probe window are slow, switch to the reader threads.
+ */
+static void aio_probe(uint64_t elapsed_ns)
+{
+	if (elapsed_ns > AWS_AIO_SLOW_USEC * 1000ULL) {
+		aio_slow++;
+		aio_slow_total++;
+	}
+	if (++aio_samples < AWS_AIO_PROBE_SAMPLES)
+		return;
+
+	if (aio_slow * 8 >= aio_samples) {
+		fprintf(stderr, "io_submit blocks (%d/%d slow), "
+				"switching to reader threads\n",
+				aio_slow, aio_samples);
+		aio_auto = 0;
+		reader_pool_start();
+	}
+	aio_slow = aio_samples = 0;
+}
+
+/*
+ * Hand n prepared reads to the reader threads or to one io_submit() per
+ * AWS_AIO_BATCH. Returns how many were queued, the rest have to be read
+ * by the caller.
+ */
+int transfer_aio_submit_batch(struct aio_op **ops, int n)
+{
+	struct iocb *piocbs[AWS_AIO_BATCH];
+	uint64_t start;
+	int done = 0, i, m, rc;
+
+	if (reader_pool_active()) {
+		for (i = 0; i < n; i++) {
+			struct aio_op *op = ops[i];
+			struct iocb *iocb = &op->iocb;
+
+			if (iocb->aio_lio_opcode == IO_CMD_PREADV) {
+				op->job.op = POOL_READV;
+				op->job.iov = iocb->u.v.vec;
+				op->job.iovcnt = iocb->u.v.nr;
+				op->job.offset = iocb->u.v.offset;
+			} else {
+				op->job.op = POOL_READ;
+				op->job.buf = iocb->u.c.buf;
+				op->job.len = iocb->u.c.nbytes;
+				op->job.offset = iocb->u.c.offset;
+			}
+			op->job.fd = iocb->aio_fildes;
+			op->job.complete = aio_op_pool_done;
+			if (reader_pool_submit(&op->job) < 0)
+				break;
+			aio_submits++;
+			aio_reads++;
+			aio_read_bytes += iocb_bytes(iocb);
+			aio_inflight += iocb_bytes(iocb);
+		}
+		return i;
+	}
+
+	if (!aio_usable)
+		return 0;
+
+	while (done < n) {
+		m = n - done > AWS_AIO_BATCH ? AWS_AIO_BATCH : n - done;
+		for (i = 0; i < m; i++) {
+			struct aio_op *op = ops[done + i];
+
+			op->iocb.data = op;
+			io_set_eventfd(&op->iocb, aio_efd);
+			piocbs[i] = &op->iocb;
+		}
+
+		start = stats_now_ns();
+		rc = io_submit(aio_ctx, m, piocbs);
+		if (aio_auto)
+			aio_probe(stats_now_ns() - start);
+		aio_submits++;
+		if (rc <= 0)
+			break;
+
+		aio_reads += rc;
+		for (i = 0; i < rc; i++) {
+			aio_read_bytes += iocb_bytes(piocbs[i]);
+			aio_inflight += iocb_bytes(piocbs[i]);
+		}
+		done += rc;
+		if (rc < m)
+			break;
+	}
+
+	return done;
+}
+
+/*
+ * Queue a prepared read on the shared context, completion on aio_efd.
+ * Returns -1 when the caller has to read synchronously.
+ */
+int transfer_aio_submit(struct aio_op *op)
+{
+	return transfer_aio_submit_batch(&op, 1) == 1 ? 0 : -1;
+}
+
+/*
+ * Reap finished reads; called when aio_efd becomes readable.
+ */
+void transfer_aio_complete(void)
+{
+	struct io_event events[64];
+	struct timespec zero = { 0, 0 };
+	uint64_t count;
+	int rc, i;
+
+	if (read(aio_efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		ERR("read eventfd");
+
+	reader_pool_complete();
+	gzip_cache_resubmit();
+
+	while (aio_usable &&
+			(rc = io_getevents(aio_ctx, 0, 64, events, &zero)) > 0) {
+		for (i = 0; i < rc; i++) {
+			struct aio_op *op = (struct aio_op *) events[i].obj;
+
+			aio_inflight -= iocb_bytes(&op->iocb);
+			op->complete(op, (long) events[i].res);
+		}
+	}
+}
+
+size_t transfer_aio_inflight(void)
+{
+	return aio_inflight;
+}
+
+static int transfer_select(const struct connection *conn)
+{
+	size_t size = body_length(conn);
+
+	if (conn->compress)
+		return TRANSFER_GZIP;
+	/* parts are framed between sends, inline has the body built up front */
+	if (size <= config.inline_max && conn->nranges < 2)
+		return TRANSFER_INLINE;
+	if (!conn->dynamic)
+		return TRANSFER_SENDFILE;
+	/* mmap faults and splice reads would block the loop on the disk */
+	if (config.direct || reader_pool_active())
+		return TRANSFER_AIO;
+	if (size <= config.medium_max)
+		return TRANSFER_MMAP;
+	return dynamic_large;
+}
+
+/*
+ * Pick an engine for the opened file in conn and prepare the body.
+ */
+int transfer_start(struct connection *conn)
+{
+	conn->range_next = 0;
+	if (conn->nranges > 0) {
+		conn->body_start = conn->ranges[0].start;
+		conn->body_end = conn->ranges[0].end;
+	} else {
+		conn->body_start = 0;
+		conn->body_end = conn->st.st_size;
+	}
+	conn->file_pos = conn->body_start;
+
+	/* the first part header follows the response header */
+	if (conn->nranges > 1)
+		conn->send_len += range_part_header(conn->send_buffer + conn->send_len,
+				BUFSIZ - conn->send_len, &conn->st,
+				conn->content_type, &conn->ranges[0]);
+
+	conn->engine = transfer_select(conn);
+
+	dlog(LOG_DEBUG, "%s: %s engine\n", conn->pathname,
+			engines[conn->engine].name);
+
+	return engines[conn->engine].start(conn);
+}
+
+/*
+ * Move a multipart response on to its next part, or to the closing
+ * delimiter after the last one. The engine sends the part header in
+ * send_buffer along with the part as it does for the response header.
+ */
+static void range_advance(struct connection *conn)
+{
+	const struct byte_range *r;
+
+	conn->range_next++;
+	conn->send_pos = 0;
+	if (conn->range_next == conn->nranges) {
+		conn->send_len = range_closing(conn->send_buffer, BUFSIZ, &conn->st);
+		return;
+	}
+
+	r = &conn->ranges[conn->range_next];
+	conn->send_len = range_part_header(conn->send_buffer, BUFSIZ,
+			&conn->st, conn->content_type, r);
+	conn->body_start = conn->file_pos = conn->read_pos = r->start;
+	conn->body_end = r->end;
+	/* the aio window drained with the previous part */
+	conn->chunk_head = 0;
+}
+
+enum transfer_status transfer_send(struct connection *conn)
+{
+	enum transfer_status status;
+
+	if (conn->nranges < 2)
+		return engines[conn->engine].send(conn);
+
+	while (conn->range_next < conn->nranges) {
+		status = engines[conn->engine].send(conn);
+		if (status != TRANSFER_DONE)
+			return status;
+		range_advance(conn);
+	}
+
+	return transfer_send_header(conn, 0);
+}
+
+/*
+ * Account the transfer and free engine resources.
+ */
+void transfer_finish(struct connection *conn)
+{
+	struct transfer_stats *s;
+
+	if (conn->engine < 0)
+		return;
+
+	s = &stats[conn->engine];
+	if (conn->state == STATE_DATA_SENT) {
+		s->completed++;
+		hist_add(&s->latency, (stats_now_ns() - conn->start_ns) / 1000);
+	} else {
+		s->failed++;
+	}
+	s->bytes += body_sent(conn);
+
+	engines[conn->engine].finish(conn);
+	conn->engine = -1;
+}
+
+/*
+ * Non-zero while the kernel still owns buffers of conn.
+ */
+int transfer_busy(const struct connection *conn)
+{
+	return conn->inflight > 0;
+}
+
+off_t transfer_progress(const struct connection *conn)
+{
+	return conn->engine >= 0 ? body_sent(conn) : 0;
+}
+
+off_t transfer_remaining(const struct connection *conn)
+{
+	off_t left = body_length(conn) - body_sent(conn);
+
+	return left > 0 ? left : 0;
+}
+
+void transfer_stats_dump(FILE *f)
+{
+	int i;
+
+	fprintf(f, "transfer: inline<=%zu medium<=%zu aio_window=%d dynamic=%s\n",
+			config.inline_max, config.medium_max, config.aio_window,
+			engines[dynamic_large].name);
+	for (i = 0; i < TRANSFER_KINDS; i++) {
+		fprintf(f, "%s: completed=%llu failed=%llu bytes=%llu "
+				"syscalls=%llu\n", engines[i].name,
+				stats[i].completed, stats[i].failed,
+				stats[i].bytes, stats[i].syscalls);
+		hist_dump(f, engines[i].name, &stats[i].latency);
+	}
+	fprintf(f, "disk: %s slow_submits=%llu\n",
+			reader_pool_active() ? "threads" : "aio", aio_slow_total);
+	fprintf(f, "disk: chunk=%zu vector=%d submits=%llu reads=%llu bytes=%llu\n",
+			config.chunk_size, config.aio_vector, aio_submits,
+			aio_reads, aio_read_bytes);
+	if (aio_read_bytes > 0)
+		fprintf(f, "disk: per MiB submits=%.2f reads=%.2f\n",
+				aio_submits * 1048576.0 / aio_read_bytes,
+				aio_reads * 1048576.0 / aio_read_bytes);
+	block_cache_stats_dump(f);
+	gzip_cache_stats_dump(f);
+	io_buffer_stats_dump(f);
+	if (config.zerocopy)
+		fprintf(f, "zerocopy: sends=%llu completions=%llu copied=%llu\n",
+				zc_sends, zc_completions, zc_copied);
+}
+
+/* Bytes pushed through each engine for every calibration size */
+#define CALIBRATE_BYTES		(32 << 20)
+
+static const size_t calibrate_sizes[] = {
+	512, 1 << 10, 2 << 10, 4 << 10, 16 << 10, 64 << 10,
+	256 << 10, 1 << 20, 4 << 20, 16 << 20
+};
+
+#define CALIBRATE_SIZES	(sizeof(calibrate_sizes) / sizeof(calibrate_sizes[0]))
+
+static uint64_t calibrate_cpu_usec(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int calibrate_wait(int fd, short events)
+{
+	struct pollfd p = { fd, events, 0 };
+
+	return poll(&p, 1, -1);
+}
+
+/*
+ * Push size bytes of fd through sockfd with the given engine.
+ */
+static int calibrate_run(int sockfd, int fd, size_t size, int kind)
+{
+	static char header[BUFSIZ];
+	struct connection *conn;
+	enum transfer_status status = TRANSFER_ERROR;
+
+	conn = calloc(1, sizeof(*conn));
+	DIE(conn == NULL, "calloc");
+
+	conn->send_buffer = header;
+	conn->pathname = "calibrate";
+	conn->sockfd = sockfd;
+	conn->fd = fd;
+	conn->dynamic = 1;
+	conn->st.st_size = size;
+	conn->body_end = size;
+	conn->engine = kind;
+	conn->turn_left = SIZE_MAX;
+
+	/* Model a real response, the engine sends the header too */
+	conn->send_len = sprintf(conn->send_buffer, "HTTP/1.0 200 OK\r\n\r\n");
+
+	if (engines[kind].start(conn) < 0)
+		goto out;
+
+	while ((status = engines[kind].send(conn)) != TRANSFER_DONE) {
+		if (status == TRANSFER_ERROR)
+			break;
+		if (status == TRANSFER_AGAIN) {
+			calibrate_wait(sockfd, POLLOUT);
+		} else {
+			calibrate_wait(aio_efd, POLLIN);
+			transfer_aio_complete();
+		}
+	}
+
+out:
+	while (conn->inflight > 0) {
+		calibrate_wait(aio_efd, POLLIN);
+		transfer_aio_complete();
+	}
+	engines[kind].finish(conn);
+	arena_release(&conn->arena);
+	free(conn);
+
+	return status == TRANSFER_DONE ? 0 : -1;
+}
+
+/*
+ * Measure every engine over a local socket pair and derive the size
+ * thresholds for this host. Results assume a warm page cache.
+ */
+void transfer_calibrate(void)
+{
+	static char block[1 << 16];
+	char path[] = "/tmp/aws-calibrate-XXXXXX";
+	double usec[CALIBRATE_SIZES][TRANSFER_KINDS];
+	double cpu[CALIBRATE_SIZES][TRANSFER_KINDS];
+	void (*wakeup)(struct connection *) = hooks.wakeup;
+	size_t s, written, inline_max = 0, medium_max = 0;
+	int fd, sv[2], kind, run, runs, rc;
+	pid_t pid;
+
+	fd = mkstemp(path);
+	DIE(fd < 0, "mkstemp");
+	unlink(path);
+
+	memset(block, 'a', sizeof(block));
+	for (written = 0; written < calibrate_sizes[CALIBRATE_SIZES - 1];
+			written += sizeof(block))
+		DIE(write(fd, block, sizeof(block)) < 0, "write");
+
+	rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	DIE(rc < 0, "socketpair");
+
+	/* Child drains everything the engines send */
+	pid = fork();
+	DIE(pid < 0, "fork");
+	if (pid == 0) {
+		close(sv[0]);
+		while (read(sv[1], block, sizeof(block)) > 0)
+			;
+		_exit(EXIT_SUCCESS);
+	}
+	close(sv[1]);
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+	hooks.wakeup = NULL;
+
+	fprintf(stderr, "%10s", "size");
+	for (kind = 0; kind < TRANSFER_KINDS; kind++)
+		fprintf(stderr, "%12s", engines[kind].name);
+	fprintf(stderr, "   (usec per transfer)\n");
+
+	for (s = 0; s < CALIBRATE_SIZES; s++) {
+		size_t size = calibrate_sizes[s];
+
+		runs = CALIBRATE_BYTES / size;
+		if (runs < 4)
+			runs = 4;
+		if (runs > 2000)
+			runs = 2000;
+
+		fprintf(stderr, "%10zu", size);
+		for (kind = 0; kind < TRANSFER_KINDS; kind++) {
+			uint64_t start = stats_now_ns();
+			uint64_t start_cpu = calibrate_cpu_usec();
+
+			usec[s][kind] = cpu[s][kind] = -1;
+			/* gzip sends a different body, it is no alternative */
+			if ((kind == TRANSFER_INLINE && size > AWS_INLINE_LIMIT) ||
+					kind == TRANSFER_GZIP) {
+				fprintf(stderr, "%12s", "-");
+				continue;
+			}
+
+			for (run = 0; run < runs; run++)
+				if (calibrate_run(sv[0], fd, size, kind) < 0)
+					break;
+
+			if (run == runs) {
+				usec[s][kind] = (stats_now_ns() - start) / 1000.0 / runs;
+				cpu[s][kind] = (calibrate_cpu_usec() - start_cpu) *
+					(double) (1 << 20) / ((double) size * runs);
+			}
+			fprintf(stderr, "%12.1f", usec[s][kind]);
+		}
+		fprintf(stderr, "\n");
+
+		/* inline has to beat every other way of sending a small file */
+		if (usec[s][TRANSFER_INLINE] >= 0 &&
+				usec[s][TRANSFER_INLINE] <= usec[s][TRANSFER_SENDFILE] &&
+				usec[s][TRANSFER_INLINE] <= usec[s][TRANSFER_MMAP])
+			inline_max = size;
+
+		/* medium tier lasts while mmap beats the large-file engine */
+		if (usec[s][TRANSFER_MMAP] >= 0 &&
+				(usec[s][dynamic_large] < 0 ||
+				 usec[s][TRANSFER_MMAP] <= usec[s][dynamic_large]))
+			medium_max = size;
+	}
+
+	fprintf(stderr, "%10s", "size");
+	for (kind = 0; kind < TRANSFER_KINDS; kind++)
+		fprintf(stderr, "%12s", engines[kind].name);
+	fprintf(stderr, "   (cpu usec per MiB)\n");
+	for (s = 0; s < CALIBRATE_SIZES; s++) {
+		fprintf(stderr, "%10zu", calibrate_sizes[s]);
+		for (kind = 0; kind < TRANSFER_KINDS; kind++)
+			if (cpu[s][kind] < 0)
+				fprintf(stderr, "%12s", "-");
+			else
+				fprintf(stderr, "%12.1f", cpu[s][kind]);
+		fprintf(stderr, "\n");
+	}
+
+	hooks.wakeup = wakeup;
+	close(sv[0]);
+	waitpid(pid, NULL, 0);
+	close(fd);
+
+	/* no mmap win leaves the medium tier empty */
+	config.inline_max = inline_max;
+	config.medium_max = medium_max > inline_max ? medium_max : inline_max;
+	memset(stats, 0, sizeof(stats));
+
+	fprintf(stderr, "calibrated: --inline-max=%zu --medium-max=%zu\n",
+			config.inline_max, config.medium_max);
+}
@@ -0,0 +1,147 @@
+/*
+ * Asynchronous Web Server - cache validators
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../headers/aws.h"
+#include "../headers/config.h"
+#include "../headers/validator.h"
+
+/* Accepted in requests; the first one is the only one ever sent */
+static const char *const http_date_formats[] = {
+	"%a, %d %b %Y %H:%M:%S GMT",	/* IMF-fixdate */
+	"%A, %d-%b-%y %H:%M:%S GMT",	/* RFC 850 */
+	"%a %b %e %H:%M:%S %Y",		/* asctime() */
+};
+
+#define HTTP_DATE_FORMATS \
+	(sizeof(http_date_formats) / sizeof(http_date_formats[0]))
+
+/* a coding applied on the fly is a representation of its own, tagged apart */
+static int etag_format(char *buf, size_t len, const struct stat *st,
+		const char *variant)
+{
+	unsigned long long mtime_ns = st->st_mtim.tv_sec * 1000000000ULL +
+		st->st_mtim.tv_nsec;
+
+	return snprintf(buf, len, "\"%llx-%llx-%llx%s%s\"",
+			(unsigned long long) st->st_ino,
+			(unsigned long long) st->st_size, mtime_ns,
+			variant != NULL ? "-" : "", variant != NULL ? variant : "");
+}
+
+int http_date_format(char *buf, size_t len, time_t t)
+{
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+
+	return strftime(buf, len, http_date_formats[0], &tm);
+}
+
+time_t http_date_parse(const char *s)
+{
+	struct tm tm;
+	const char *end;
+	size_t i;
+
+	for (i = 0; i < HTTP_DATE_FORMATS; i++) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(s, http_date_formats[i], &tm);
+		if (end != NULL && end[strspn(end, " \t")] == '\0')
+			return timegm(&tm);
+	}
+
+	return -1;
+}
+
+int validator_headers(char *buf, size_t len, const struct stat *st,
+		const char *variant)
+{
+	char etag[AWS_ETAG_LEN];
+	char date[AWS_HTTP_DATE_LEN];
+
+	etag_format(etag, sizeof(etag), st, variant);
+	http_date_format(date, sizeof(date), st->st_mtim.tv_sec);
+
+	return snprintf(buf, len, "ETag: %s\r\nLast-Modified: %s\r\n"
+			"Cache-Control: max-age=%d\r\n", etag, date,
+			config.max_age);
+}
+
+/*
+ * Look for etag in a list of entity tags. The weak comparison of
+ * If-None-Match ignores W/ prefixes, the strong one of If-Range does not
+ * match them at all.
+ */
+static int etag_match(const char *list, const char *etag, int weak)
+{
+	size_t len = strlen(etag);
+	const char *p = list;
+	int is_weak;
+
+	for (;;) {
+		p += strspn(p, " \t,");
+		if (*p == '\0')
+			return 0;
+		if (*p == '*')
+			return 1;
+
+		is_weak = strncmp(p, "W/", 2) == 0;
+		if (is_weak)
+			p += 2;
+		if ((weak || !is_weak) && strncmp(p, etag, len) == 0 &&
+				strchr(" \t,", p[len]) != NULL)
+			return 1;
+
+		/* on to the next tag; a comma may hide inside the quotes */
+		if (*p == '"') {
+			p = strchr(p + 1, '"');
+			if (p == NULL)
+				return 0;
+			p++;
+		}
+		p += strcspn(p, ",");
+	}
+}
+
+int validator_not_modified(const struct stat *st, const char *variant,
+		const char *if_none_match, const char *if_modified_since)
+{
+	char etag[AWS_ETAG_LEN];
+	time_t since;
+
+	/* If-Modified-Since only counts without If-None-Match */
+	if (if_none_match != NULL) {
+		etag_format(etag, sizeof(etag), st, variant);
+		return etag_match(if_none_match, etag, 1);
+	}
+
+	if (if_modified_since == NULL)
+		return 0;
+	since = http_date_parse(if_modified_since);
+
+	return since != -1 && st->st_mtim.tv_sec <= since;
+}
+
+int validator_range_ok(const struct stat *st, const char *if_range)
+{
+	char etag[AWS_ETAG_LEN];
+
+	if (if_range == NULL)
+		return 1;
+
+	if_range += strspn(if_range, " \t");
+	if (*if_range == '"' || *if_range == 'W') {
+		etag_format(etag, sizeof(etag), st, NULL);
+		return etag_match(if_range, etag, 0);
+	}
+
+	/* a date only validates the exact Last-Modified */
+	return http_date_parse(if_range) == st->st_mtim.tv_sec;
+}
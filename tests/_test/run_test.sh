@@ -23,7 +23,7 @@ DO_CLEANUP=yes
 # Enable/disable exiting when program fails.
 EXIT_IF_FAIL=0
 
-max_points=90
+max_points=138
 
 DEBUG()
 {
@@ -77,14 +77,20 @@ basic_test()
 	fi
 }
 
+# Status code of the response whose header was dumped in file $1
+http_status()
+{
+	head -1 "$1" | awk '{ print $2 }'
+}
+
 # ---------------------------------------------------------------------------- #
 
 # ----------------- Init and cleanup tests ----------------------------------- #
 
-# Initializes a test
+# Initializes a test; arguments are passed on to the server
 init_test()
 {
-	$exec_name &>> $LOG_FILE &
+	$exec_name "$@" &>> $LOG_FILE &
 	if test $? -eq 0; then
 		exec_pid=$!
 	fi
@@ -95,6 +101,8 @@ init_test()
 cleanup_test()
 {
 	kill -9 "$exec_pid" &>> $LOG_FILE
+	# the next test binds the port as soon as this server is gone
+	wait "$exec_pid" &>> $LOG_FILE
 	if [ "$DO_CLEANUP" = "yes" ]; then
 		rm -rf $WGET_LOG &>> $LOG_FILE
 	fi
@@ -717,6 +725,618 @@ test_get_multiple_simultaneous_stat_dyn_files()
     cleanup_test
 }
 
+range_single_ok()
+{
+	test "$(http_status range.hdr)" = 206 || return 1
+	grep -q "^Content-Range: bytes 100-1123/1048576" range.hdr || return 1
+	tail -c +101 $static_folder/large00.dat | head -c 1024 | cmp - range.dat
+}
+
+test_get_single_range()
+{
+    init_test
+
+    curl -s -D range.hdr -o range.dat -H "Range: bytes=100-1123" \
+		"http://localhost:8888/$(basename $static_folder)/large00.dat"
+    basic_test range_single_ok
+
+    rm -f range.hdr range.dat
+    cleanup_test
+}
+
+# Expected body for bytes=0-9,-10 of the 2 KiB file $1, boundary $2
+range_multipart_body()
+{
+	printf "\r\n--%s\r\nContent-Type: application/octet-stream\r\n" "$2"
+	printf "Content-Range: bytes 0-9/2048\r\n\r\n"
+	head -c 10 "$1"
+	printf "\r\n--%s\r\nContent-Type: application/octet-stream\r\n" "$2"
+	printf "Content-Range: bytes 2038-2047/2048\r\n\r\n"
+	tail -c 10 "$1"
+	printf "\r\n--%s--\r\n" "$2"
+}
+
+range_multipart_ok()
+{
+	test "$(http_status range.hdr)" = 206 || return 1
+	boundary=$(grep "^Content-Type: multipart/byteranges; boundary=" \
+		range.hdr | sed 's/.*boundary=//' | tr -d '\r')
+	test -n "$boundary" || return 1
+	range_multipart_body $dynamic_folder/small00.dat "$boundary" | \
+		cmp - range.dat
+}
+
+test_get_multipart_ranges()
+{
+    init_test
+
+    curl -s -D range.hdr -o range.dat -H "Range: bytes=0-9,-10" \
+		"http://localhost:8888/$(basename $dynamic_folder)/small00.dat"
+    basic_test range_multipart_ok
+
+    rm -f range.hdr range.dat
+    cleanup_test
+}
+
+range_unsatisfiable_ok()
+{
+	test "$(http_status range.hdr)" = 416 || return 1
+	grep -q "^Content-Range: bytes \*/2048" range.hdr || return 1
+	test ! -s range.dat
+}
+
+test_get_unsatisfiable_range_416()
+{
+    init_test
+
+    curl -s -D range.hdr -o range.dat -H "Range: bytes=4096-" \
+		"http://localhost:8888/$(basename $static_folder)/small00.dat"
+    basic_test range_unsatisfiable_ok
+
+    rm -f range.hdr range.dat
+    cleanup_test
+}
+
+# Value of header $2 in the response header dumped in file $1
+http_header()
+{
+	grep -i "^$2:" "$1" | head -1 | sed 's/^[^:]*: *//' | tr -d '\r'
+}
+
+if_none_match_ok()
+{
+	test "$(http_status cond.hdr)" = 304 || return 1
+	test ! -s cond.dat || return 1
+	test "$(http_status other.hdr)" = 200 || return 1
+	cmp other.dat $static_folder/small00.dat
+}
+
+test_if_none_match_304()
+{
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    curl -s -D first.hdr -o /dev/null "$url"
+    etag=$(http_header first.hdr ETag)
+    curl -s -D cond.hdr -o cond.dat -H "If-None-Match: $etag" "$url"
+    curl -s -D other.hdr -o other.dat -H 'If-None-Match: "other"' "$url"
+    basic_test if_none_match_ok
+
+    rm -f first.hdr cond.hdr cond.dat other.hdr other.dat
+    cleanup_test
+}
+
+if_modified_since_ok()
+{
+	test "$(http_status cond.hdr)" = 304 || return 1
+	test ! -s cond.dat || return 1
+	test "$(http_status other.hdr)" = 200 || return 1
+	cmp other.dat $dynamic_folder/small00.dat
+}
+
+test_if_modified_since_304()
+{
+    init_test
+
+    url="http://localhost:8888/$(basename $dynamic_folder)/small00.dat"
+    curl -s -D first.hdr -o /dev/null "$url"
+    modified=$(http_header first.hdr Last-Modified)
+    curl -s -D cond.hdr -o cond.dat -H "If-Modified-Since: $modified" "$url"
+    curl -s -D other.hdr -o other.dat \
+		-H "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT" "$url"
+    basic_test if_modified_since_ok
+
+    rm -f first.hdr cond.hdr cond.dat other.hdr other.dat
+    cleanup_test
+}
+
+sidecar_ok()
+{
+	test "$(http_status gz.hdr)" = 200 || return 1
+	test "$(http_header gz.hdr Content-Encoding)" = gzip || return 1
+	test "$(http_header gz.hdr Vary)" = Accept-Encoding || return 1
+	cmp gz.dat $static_folder/side.js.gz || return 1
+	test "$(http_status br.hdr)" = 200 || return 1
+	test "$(http_header br.hdr Content-Encoding)" = br || return 1
+	test "$(http_header br.hdr Vary)" = Accept-Encoding || return 1
+	cmp br.dat $static_folder/side.js.br
+}
+
+test_sidecar_encodings()
+{
+    seq 1 20000 > $static_folder/side.js
+    gzip -c $static_folder/side.js > $static_folder/side.js.gz
+    # sent as it is, so any bytes stand in for brotli
+    echo "brotli stand-in" > $static_folder/side.js.br
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)/side.js"
+    curl -s -D gz.hdr -o gz.dat -H "Accept-Encoding: gzip" "$url"
+    curl -s -D br.hdr -o br.dat -H "Accept-Encoding: br" "$url"
+    basic_test sidecar_ok
+
+    rm -f gz.hdr gz.dat br.hdr br.dat $static_folder/side.js*
+    cleanup_test
+}
+
+sidecar_identity_ok()
+{
+	# refused with q=0: the file itself, still varying on the header
+	test "$(http_status refused.hdr)" = 200 || return 1
+	test -z "$(http_header refused.hdr Content-Encoding)" || return 1
+	test "$(http_header refused.hdr Vary)" = Accept-Encoding || return 1
+	cmp refused.dat $static_folder/side.js || return 1
+	# older than the file: as if there were none
+	test "$(http_status stale.hdr)" = 200 || return 1
+	test -z "$(http_header stale.hdr Content-Encoding)" || return 1
+	test -z "$(http_header stale.hdr Vary)" || return 1
+	cmp stale.dat $static_folder/stale.js
+}
+
+test_sidecar_refused_or_stale()
+{
+    seq 1 20000 > $static_folder/side.js
+    gzip -c $static_folder/side.js > $static_folder/side.js.gz
+    seq 1 20000 > $static_folder/stale.js
+    gzip -c $static_folder/stale.js > $static_folder/stale.js.gz
+    touch -d "1 hour ago" $static_folder/stale.js.gz
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)"
+    curl -s -D refused.hdr -o refused.dat \
+		-H "Accept-Encoding: gzip;q=0, identity" "$url/side.js"
+    curl -s -D stale.hdr -o stale.dat -H "Accept-Encoding: gzip" \
+		"$url/stale.js"
+    basic_test sidecar_identity_ok
+
+    rm -f refused.hdr refused.dat stale.hdr stale.dat
+    rm -f $static_folder/side.js* $static_folder/stale.js*
+    cleanup_test
+}
+
+keep_alive_ok()
+{
+	test "$(grep -c '^HTTP/1.1 200 ' ka.hdr)" -eq 2 || return 1
+	# the second response came on the connection of the first
+	test "$(cat ka.conn)" = "1 0 " || return 1
+	cmp ka1.dat $static_folder/small00.dat || return 1
+	cmp ka2.dat $static_folder/large00.dat
+}
+
+test_keep_alive()
+{
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)"
+    curl -s -D ka.hdr -w '%{num_connects} ' -o ka1.dat "$url/small00.dat" \
+		-o ka2.dat "$url/large00.dat" > ka.conn
+    basic_test keep_alive_ok
+
+    rm -f ka.hdr ka.conn ka1.dat ka2.dat
+    cleanup_test
+}
+
+chunked_ok()
+{
+	test "$(grep -c '^HTTP/1.1 200 ' ka.hdr)" -eq 2 || return 1
+	test "$(grep -ci '^Transfer-Encoding: chunked' ka.hdr)" -eq 2 || \
+		return 1
+	grep -qi '^Content-Encoding: gzip' ka.hdr || return 1
+	test "$(cat ka.conn)" = "1 0 " || return 1
+	cmp ka1.dat $dynamic_folder/text.txt || return 1
+	cmp ka2.dat $dynamic_folder/text.txt || return 1
+	# framing as sent: the last chunk is empty
+	test "$(tail -c 5 ka.raw | od -An -c | tr -d ' ')" = '0\r\n\r\n'
+}
+
+test_chunked_keep_alive()
+{
+    seq 1 200000 > $dynamic_folder/text.txt
+    init_test --gzip
+
+    url="http://localhost:8888/$(basename $dynamic_folder)/text.txt"
+    curl -s --compressed -D ka.hdr -w '%{num_connects} ' -o ka1.dat "$url" \
+		-o ka2.dat "$url" > ka.conn
+    curl -s --raw -H "Accept-Encoding: gzip" -o ka.raw "$url"
+    basic_test chunked_ok
+
+    rm -f ka.hdr ka.conn ka1.dat ka2.dat ka.raw $dynamic_folder/text.txt
+    cleanup_test
+}
+
+# Send $1 on a new connection and read until the server closes it, at
+# most 5 seconds; sets read_status and elapsed (ms) and saves the answer
+# in answer.dat
+read_until_closed()
+{
+	exec 3<> /dev/tcp/localhost/$aws_listen_port || return 1
+	start=$(date +%s%N)
+	# not the builtin: it writes line by line, the request goes at once
+	env printf "$1" >&3
+	timeout 5 cat <&3 > answer.dat
+	read_status=$?
+	elapsed=$((($(date +%s%N) - start) / 1000000))
+	exec 3<&-
+}
+
+head_ok()
+{
+	test "$(http_status get.hdr)" = 200 || return 1
+	cmp get.hdr head.hdr || return 1
+	# the header and nothing after it
+	head -1 answer.dat | grep -q '^HTTP/1.0 200 ' || return 1
+	test "$(tail -c 4 answer.dat | od -An -c | tr -d ' ')" = '\r\n\r\n'
+}
+
+test_head_as_get()
+{
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    curl -s -D get.hdr -o /dev/null "$url"
+    curl -s -I "$url" > head.hdr
+    read_until_closed "HEAD /$(basename $static_folder)/small00.dat HTTP/1.0\r\n\r\n"
+    basic_test head_ok
+
+    rm -f get.hdr head.hdr answer.dat
+    cleanup_test
+}
+
+head_index_ok()
+{
+	# a change within the path index TTL does not show
+	test "$(http_header cached.hdr Content-Length)" = 2048 || return 1
+	test "$(http_header reloaded.hdr Content-Length)" = 2053 || return 1
+	cmp reloaded.hdr get.hdr
+}
+
+test_head_path_index()
+{
+    cp $static_folder/small00.dat $static_folder/index.dat
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)/index.dat"
+    curl -s -I "$url" > first.hdr
+    echo "more" >> $static_folder/index.dat
+    curl -s -I "$url" > cached.hdr
+    sleep 10.5
+    curl -s -I "$url" > reloaded.hdr
+    curl -s -D get.hdr -o /dev/null "$url"
+    basic_test head_index_ok
+
+    rm -f first.hdr cached.hdr reloaded.hdr get.hdr
+    rm -f $static_folder/index.dat
+    cleanup_test
+}
+
+methods_ok()
+{
+	test "$(http_status post.hdr)" = 405 || return 1
+	test "$(http_header post.hdr Allow)" = "GET, HEAD" || return 1
+	test "$(http_status foo.hdr)" = 501
+}
+
+test_methods_405_501()
+{
+    init_test
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    curl -s -X POST -D post.hdr -o /dev/null "$url"
+    curl -s -X FOO -D foo.hdr -o /dev/null "$url"
+    basic_test methods_ok
+
+    rm -f post.hdr foo.hdr
+    cleanup_test
+}
+
+header_timeout_ok()
+{
+	# closed, not left to the 5 second limit, and without an answer
+	test "$read_status" -eq 0 || return 1
+	test "$elapsed" -ge 900 -a "$elapsed" -lt 3000 || return 1
+	test ! -s answer.dat
+}
+
+test_header_timeout()
+{
+    init_test --header-timeout=1
+
+    read_until_closed ""
+    basic_test header_timeout_ok
+
+    rm -f answer.dat
+    cleanup_test
+}
+
+idle_timeout_ok()
+{
+	test "$read_status" -eq 0 || return 1
+	test "$elapsed" -ge 900 -a "$elapsed" -lt 3000 || return 1
+	head -1 answer.dat | grep -q '^HTTP/1.1 200 '
+}
+
+test_idle_timeout()
+{
+    init_test --idle-timeout=1
+
+    read_until_closed "GET /$(basename $static_folder)/small00.dat HTTP/1.1\r\n\r\n"
+    basic_test idle_timeout_ok
+
+    rm -f answer.dat
+    cleanup_test
+}
+
+split_request_ok()
+{
+	test "$read_status" -eq 0 || return 1
+	head -1 answer.dat | grep -q '^HTTP/1.0 200 ' || return 1
+	tail -c 2048 answer.dat | cmp - $static_folder/small00.dat
+}
+
+test_split_request()
+{
+    init_test
+
+    # the request comes in three reads, the path cut in two
+    exec 3<> /dev/tcp/localhost/$aws_listen_port
+    env printf "GET /$(basename $static_folder)/sma" >&3
+    sleep 0.3
+    env printf "ll00.dat HTTP/1.0\r\n" >&3
+    sleep 0.3
+    env printf "\r\n" >&3
+    timeout 5 cat <&3 > answer.dat
+    read_status=$?
+    exec 3<&-
+    basic_test split_request_ok
+
+    rm -f answer.dat
+    cleanup_test
+}
+
+partial_header_ok()
+{
+	test "$read_status" -eq 0 || return 1
+	test "$elapsed" -ge 900 -a "$elapsed" -lt 3000 || return 1
+	head -1 answer.dat | grep -q '^HTTP/1.0 408 '
+}
+
+test_partial_header_408()
+{
+    init_test --header-timeout=1
+
+    read_until_closed "GET /$(basename $static_folder)/small00.dat HTTP/1.1\r\n"
+    basic_test partial_header_ok
+
+    rm -f answer.dat
+    cleanup_test
+}
+
+overload_503_ok()
+{
+	test "$(http_status over.hdr)" = 503 || return 1
+	test -n "$(http_header over.hdr Retry-After)" || return 1
+	test "$(http_status again.hdr)" = 200 || return 1
+	cmp again.dat $static_folder/small00.dat
+}
+
+test_overload_503()
+{
+    init_test --max-connections=1 --overload=503
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    # the one connection allowed, held open without a request
+    exec 3<> /dev/tcp/localhost/$aws_listen_port
+    sleep 0.2
+    curl -s -D over.hdr -o /dev/null "$url"
+    exec 3<&-
+    sleep 0.2
+    curl -s -D again.hdr -o again.dat "$url"
+    basic_test overload_503_ok
+
+    rm -f over.hdr again.hdr again.dat
+    cleanup_test
+}
+
+overload_pause_ok()
+{
+	# not answered while the server was full, served once it was not
+	test -z "$held" || return 1
+	test "$(http_status paused.hdr)" = 200 || return 1
+	cmp paused.dat $static_folder/small00.dat
+}
+
+test_overload_pause()
+{
+    init_test --max-connections=1
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    exec 3<> /dev/tcp/localhost/$aws_listen_port
+    sleep 0.2
+    curl -s -D paused.hdr -o paused.dat "$url" &
+    curl_pid=$!
+    sleep 1
+    held=$(cat paused.hdr 2> /dev/null)
+    exec 3<&-
+    wait $curl_pid
+    basic_test overload_pause_ok
+
+    rm -f paused.hdr paused.dat
+    cleanup_test
+}
+
+codel_ok()
+{
+	grep -q '^HTTP/1.0 503 ' answer.dat || return 1
+	test "$(http_status prompt.hdr)" = 200
+}
+
+test_codel_shed()
+{
+    init_test --codel=1 --codel-interval=50
+
+    # each request waits well past the target after its connection
+    request="GET /$(basename $static_folder)/small00.dat HTTP/1.0\r\n\r\n"
+    for i in $(seq 1 4); do
+        exec 3<> /dev/tcp/localhost/$aws_listen_port
+        sleep 0.1
+        env printf "$request" >&3
+        timeout 2 head -1 <&3 >> answer.dat
+        exec 3<&-
+    done
+    # one sent right away is under the target again
+    curl -s -D prompt.hdr -o /dev/null \
+		"http://localhost:8888/$(basename $static_folder)/small00.dat"
+    basic_test codel_ok
+
+    rm -f answer.dat prompt.hdr
+    cleanup_test
+}
+
+send_quantum_ok()
+{
+	for i in 1 2 3; do
+		cmp quantum$i.dat $static_folder/large0$i.dat || return 1
+	done
+	# 3 MiB in turns of at most 4 KiB, some cut short by a full socket
+	yields=$(grep '^send_sched:' $LOG_FILE | tail -1 | \
+		sed 's/.* yields=\([0-9]*\).*/\1/')
+	test "$yields" -ge 384
+}
+
+test_send_quantum()
+{
+    init_test --send-quantum=4K
+
+    for i in 1 2 3; do
+        curl -s -o quantum$i.dat \
+			"http://localhost:8888/$(basename $static_folder)/large0$i.dat" &
+        pids[$i]=$!
+    done
+    for i in 1 2 3; do
+        wait ${pids[$i]}
+    done
+    kill -USR1 "$exec_pid"
+    sleep 0.2
+    basic_test send_quantum_ok
+
+    rm -f quantum1.dat quantum2.dat quantum3.dat
+    cleanup_test
+}
+
+rate_limit_ok()
+{
+	cmp limited.dat $static_folder/large00.dat || return 1
+	# 1 MiB at 256 KiB/s, less the burst the bucket starts with
+	test "$elapsed" -ge 3500
+}
+
+test_rate_limit()
+{
+    init_test --rate-limit=256K
+
+    start=$(date +%s%N)
+    curl -s -o limited.dat \
+		"http://localhost:8888/$(basename $static_folder)/large00.dat"
+    elapsed=$((($(date +%s%N) - start) / 1000000))
+    basic_test rate_limit_ok
+
+    rm -f limited.dat
+    cleanup_test
+}
+
+rate_burst_ok()
+{
+	cmp burst.dat $static_folder/burst.dat || return 1
+	# 64 KiB is the burst and 50 ms of the rate: neither instant nor
+	# held back for a whole timer tick
+	awk -v t="$total" 'BEGIN { exit !(t >= 0.04 && t < 0.1) }'
+}
+
+test_rate_limit_burst()
+{
+    head -c 65536 $static_folder/large00.dat > $static_folder/burst.dat
+    init_test --rate-limit=256K
+
+    total=$(curl -s -o burst.dat -w '%{time_total}' \
+		"http://localhost:8888/$(basename $static_folder)/burst.dat")
+    basic_test rate_burst_ok
+
+    rm -f burst.dat $static_folder/burst.dat
+    cleanup_test
+}
+
+client_rate_ok()
+{
+	test "$codes" = "200 200 429 429 " || return 1
+	test -n "$(http_header rate.hdr Retry-After)" || return 1
+	test "$(http_status again.hdr)" = 200 || return 1
+	cmp again.dat $static_folder/small00.dat
+}
+
+test_client_rate_429()
+{
+    init_test --client-rate=1 --client-burst=2
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    codes=""
+    for i in $(seq 1 4); do
+        codes="$codes$(curl -s -D rate.hdr -o /dev/null -w '%{http_code}' \
+			"$url") "
+    done
+    # a second later the bucket holds a request again
+    sleep 1.1
+    curl -s -D again.hdr -o again.dat "$url"
+    basic_test client_rate_ok
+
+    rm -f rate.hdr again.hdr again.dat
+    cleanup_test
+}
+
+client_connections_ok()
+{
+	test "$(http_status over.hdr)" = 503 || return 1
+	test "$(http_status again.hdr)" = 200 || return 1
+	cmp again.dat $static_folder/small00.dat
+}
+
+test_client_connections_503()
+{
+    init_test --client-connections=1
+
+    url="http://localhost:8888/$(basename $static_folder)/small00.dat"
+    # the one connection allowed, held open without a request
+    exec 3<> /dev/tcp/localhost/$aws_listen_port
+    sleep 0.2
+    curl -s -D over.hdr -o /dev/null "$url"
+    exec 3<&-
+    sleep 0.2
+    curl -s -D again.hdr -o again.dat "$url"
+    basic_test client_connections_ok
+
+    rm -f over.hdr again.hdr again.dat
+    cleanup_test
+}
+
 
 # specifies the tests, commands and points
 test_fun_array=(								\
@@ -756,6 +1376,30 @@ test_fun_array=(								\
 	test_get_two_sim_stat_dyn_files "Test two simultaneous dynamic files stat" 4
 	test_get_multiple_simultaneous_stat_dyn_files \
 		"Test multiple simultaneous dynamic files stat" 5
+	test_get_single_range "Test single range 206" 2
+	test_get_multipart_ranges "Test multipart ranges 206" 2
+	test_get_unsatisfiable_range_416 "Test unsatisfiable range 416" 2
+	test_if_none_match_304 "Test If-None-Match 304" 2
+	test_if_modified_since_304 "Test If-Modified-Since 304" 2
+	test_sidecar_encodings "Test precompressed sidecars" 2
+	test_sidecar_refused_or_stale "Test refused and stale sidecars" 2
+	test_keep_alive "Test keep-alive connection" 2
+	test_chunked_keep_alive "Test chunked gzip keep-alive" 2
+	test_head_as_get "Test HEAD headers as GET" 2
+	test_head_path_index "Test HEAD from path index" 2
+	test_methods_405_501 "Test methods 405 and 501" 2
+	test_header_timeout "Test request header timeout" 2
+	test_idle_timeout "Test keep-alive idle timeout" 2
+	test_split_request "Test request split across reads" 2
+	test_partial_header_408 "Test partial header 408" 2
+	test_overload_503 "Test overload 503" 2
+	test_overload_pause "Test overload pause" 2
+	test_codel_shed "Test CoDel shed 503" 2
+	test_send_quantum "Test send quantum yields" 2
+	test_rate_limit "Test rate-limited download" 2
+	test_rate_limit_burst "Test rate limit past the burst" 2
+	test_client_rate_429 "Test client request rate 429" 2
+	test_client_connections_503 "Test client connections 503" 2
 	)
 
 # ---------------------------------------------------------------------------- #
@@ -0,0 +1,80 @@
+#!/bin/bash
+#
+# Check that serving requests costs no heap calls once the server is warm.
+#
+# Run from the top directory after `make aws-alloc`:
+#	tests/bench/alloc_check.sh [budget] [rounds] [warmup] [server options]
+#
+# A round requests every file kind (inline, sendfile, mmap, aio, 404) from
+# both folders. After `warmup` rounds fill the pools, `rounds` more are
+# served and the heap calls made in between are reported per request
+# phase (accept, receive, parse, open, send). The check fails if their sum
+# exceeds `budget` (0 by default).
+
+budget=${1:-0}
+rounds=${2:-20}
+warmup=${3:-1}
+shift 3 2>/dev/null || shift $#
+aws=$(realpath ./aws-alloc)
+port=8888
+phases="other accept receive parse open send"
+
+work=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+for d in static dynamic; do
+	head -c 1000 /dev/urandom > "$work/$d/small.dat"
+	head -c 200000 /dev/urandom > "$work/$d/medium.dat"
+	head -c 3000000 /dev/urandom > "$work/$d/large.dat"
+done
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+run_round()
+{
+	for d in static dynamic; do
+		for f in small.dat medium.dat large.dat missing.dat; do
+			wget -q -O /dev/null "http://localhost:$port/$d/$f"
+		done
+	done
+}
+
+# Per-phase counts of a fresh SIGUSR1 dump, in the order of $phases
+alloc_counts()
+{
+	kill -USR1 $pid
+	sleep 0.2
+	for p in $phases; do
+		grep "^alloc $p:" aws.err | tail -1 | awk '{ print $3 }'
+	done
+}
+
+for i in $(seq 1 "$warmup"); do
+	run_round
+done
+before=($(alloc_counts))
+for i in $(seq 1 "$rounds"); do
+	run_round
+done
+after=($(alloc_counts))
+
+if [ ${#before[@]} -eq 0 ] || [ ${#after[@]} -eq 0 ]; then
+	echo "no allocation counts, was aws-alloc built?"
+	exit 1
+fi
+
+total=0
+i=0
+for p in $phases; do
+	calls=$((after[i] - before[i]))
+	printf "%-8s %d\n" "$p" "$calls"
+	total=$((total + calls))
+	i=$((i + 1))
+done
+
+echo "heap calls after warmup: $total ($((rounds * 8)) requests, budget $budget)"
+[ "$total" -le "$budget" ]
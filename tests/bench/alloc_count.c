@@ -0,0 +1,84 @@
+/*
+ * Asynchronous Web Server - heap call counter
+ *
+ * Linked into the aws-alloc build with -Wl,--wrap for every allocator
+ * entry point, so only calls made by the server's own objects are
+ * counted. Each call is also charged to the request phase the main loop
+ * is in (see alloc_phase.h). Totals are printed with the other statistics
+ * on SIGUSR1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../headers/alloc_phase.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+enum alloc_call {
+	ALLOC_MALLOC,
+	ALLOC_CALLOC,
+	ALLOC_REALLOC,
+	ALLOC_FREE,
+	ALLOC_CALLS
+};
+
+static const char * const phase_names[ALLOC_PHASES] = {
+	[ALLOC_OTHER] = "other",
+	[ALLOC_ACCEPT] = "accept",
+	[ALLOC_RECEIVE] = "receive",
+	[ALLOC_PARSE] = "parse",
+	[ALLOC_OPEN] = "open",
+	[ALLOC_SEND] = "send",
+};
+
+/* Reader threads may allocate too, count atomically */
+static unsigned long long counts[ALLOC_CALLS];
+static unsigned long long phase_counts[ALLOC_PHASES];
+
+static void count(enum alloc_call call)
+{
+	enum alloc_phase phase = alloc_phase;
+
+	__atomic_fetch_add(&counts[call], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&phase_counts[phase], 1, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	count(ALLOC_MALLOC);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	count(ALLOC_CALLOC);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	count(ALLOC_REALLOC);
+	return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	if (ptr != NULL)
+		count(ALLOC_FREE);
+	__real_free(ptr);
+}
+
+void alloc_stats_dump(FILE *f)
+{
+	int i;
+
+	fprintf(f, "alloc: malloc=%llu calloc=%llu realloc=%llu free=%llu\n",
+			counts[ALLOC_MALLOC], counts[ALLOC_CALLOC],
+			counts[ALLOC_REALLOC], counts[ALLOC_FREE]);
+	for (i = 0; i < ALLOC_PHASES; i++)
+		fprintf(f, "alloc %s: %llu\n", phase_names[i], phase_counts[i]);
+}
@@ -0,0 +1,105 @@
+/*
+ * Asynchronous Web Server - idle connection memory benchmark
+ *
+ * Opens N connections to a running server without sending a request and
+ * reports how much the server's resident set grew per connection.
+ *
+ * usage: c10k_mem <server pid> [connections] [port]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_CONNECTIONS	10000
+#define DEFAULT_PORT		8888
+
+/* VmRSS of pid in bytes, -1 if it can not be read */
+static long long read_rss(int pid)
+{
+	char path[64], line[256];
+	long long kb = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "VmRSS: %lld kB", &kb) == 1)
+			break;
+	fclose(f);
+
+	return kb < 0 ? -1 : kb * 1024;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	struct rlimit rl;
+	long long before, after;
+	int pid, n, port, i, opened = 0;
+	int *fds;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <server pid> [connections] [port]\n", argv[0]);
+		return 1;
+	}
+	pid = atoi(argv[1]);
+	n = argc > 2 ? atoi(argv[2]) : DEFAULT_CONNECTIONS;
+	port = argc > 3 ? atoi(argv[3]) : DEFAULT_PORT;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	fds = calloc(n, sizeof(*fds));
+	if (fds == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	before = read_rss(pid);
+	if (before < 0) {
+		fprintf(stderr, "can not read VmRSS of %d\n", pid);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (fds[i] < 0 || connect(fds[i], (struct sockaddr *) &addr,
+				sizeof(addr)) < 0) {
+			perror("connect");
+			break;
+		}
+		opened++;
+	}
+
+	/* Let the server drain its accept queue */
+	sleep(1);
+	after = read_rss(pid);
+
+	printf("connections: %d\n", opened);
+	printf("rss before:  %lld bytes\n", before);
+	printf("rss after:   %lld bytes\n", after);
+	if (opened > 0)
+		printf("per idle connection: %lld bytes\n", (after - before) / opened);
+
+	for (i = 0; i < opened; i++)
+		close(fds[i]);
+	free(fds);
+
+	return 0;
+}
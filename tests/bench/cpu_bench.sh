@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+# Server CPU time per MiB sent, for one large file.
+#
+# Run from the top directory after `make`:
+#	tests/bench/cpu_bench.sh [requests] [size] [folder] [server options]
+#
+# `requests` downloads of a `size` byte file (dynamic/ by default) run
+# 4 at a time. User and system time of the server come from
+# /proc/<pid>/stat.
+
+requests=${1:-50}
+size=${2:-16777216}
+folder=${3:-dynamic}
+shift 3 2>/dev/null || shift $#
+aws=$(realpath ./aws)
+port=8888
+clients=4
+
+work=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+head -c "$size" /dev/urandom > "$work/$folder/bench.dat"
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+# utime + stime in clock ticks
+cpu_ticks()
+{
+	awk '{ print $14 + $15 }' /proc/$pid/stat
+}
+
+fetch()
+{
+	for i in $(seq 1 "$1"); do
+		wget -q -O /dev/null "http://localhost:$port/$folder/bench.dat"
+	done
+}
+
+before=$(cpu_ticks)
+start=$(date +%s.%N)
+for c in $(seq 1 $clients); do
+	fetch $((requests / clients)) &
+done
+wait $(jobs -p | grep -v "^$pid$")
+end=$(date +%s.%N)
+after=$(cpu_ticks)
+
+awk -v t=$((after - before)) -v hz="$(getconf CLK_TCK)" -v s="$start" \
+	-v e="$end" -v n=$((requests / clients * clients)) -v size="$size" '
+BEGIN {
+	mib = n * size / 1048576;
+	printf "sent %.0f MiB in %.2f s, %.1f MiB/s\n", mib, e - s, mib / (e - s);
+	printf "server cpu %.2f s, %.1f us per MiB\n", t / hz, t / hz * 1e6 / mib;
+}'
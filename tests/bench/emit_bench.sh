@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Segments and send-side system calls per response, by engine.
+#
+# Run from the top directory after `make`:
+#	tests/bench/emit_bench.sh [requests] [server options]
+#
+# Every file is fetched `requests` times, one client at a time. The TCP
+# segments the host sent in that time (both directions, the client is
+# local) come from /proc/net/snmp. The server's syscall counters come from
+# its SIGUSR1 dump.
+
+requests=${1:-200}
+shift $(($# > 0 ? 1 : 0))
+aws=$(realpath ./aws)
+port=8888
+
+work=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+head -c 1000 /dev/urandom > "$work/static/small.dat"
+head -c 20000 /dev/urandom > "$work/static/file.dat"
+head -c 200000 /dev/urandom > "$work/dynamic/medium.dat"
+head -c 3000000 /dev/urandom > "$work/dynamic/large.dat"
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+out_segs()
+{
+	awk '/^Tcp:/ { if (n++) print $12 }' /proc/net/snmp
+}
+
+printf "%-22s %12s\n" "file" "segs/request"
+for f in static/small.dat static/file.dat dynamic/medium.dat dynamic/large.dat; do
+	before=$(out_segs)
+	for i in $(seq 1 "$requests"); do
+		wget -q -O /dev/null "http://localhost:$port/$f"
+	done
+	after=$(out_segs)
+	awk -v f="$f" -v n=$((after - before)) -v r="$requests" \
+		'BEGIN { printf "%-22s %12.2f\n", f, n / r }'
+done
+
+kill -USR1 $pid
+sleep 0.2
+echo
+grep -E '^[a-z]+: completed=' aws.err | tail -5 |
+	awk -F'[ =]' '$3 > 0 { printf "%-10s syscalls/response %.2f\n", $1, $9 / $3 }'
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Latency of small responses while bulk downloads share the event loop.
+#
+# Run from the top directory after `make`:
+#	tests/bench/mixed_bench.sh [bulk] [requests] [server options]
+#
+# `bulk` clients download a 256 MB static/ file (sendfile) over and over
+# while one client at a time fetches a small static/ file `requests`
+# times. Compare --send-quantum=0 (a response sends until its socket is
+# full) with the default quantum, and --send-policy=rr with srf.
+
+bulk=${1:-8}
+requests=${2:-2000}
+shift 2 2>/dev/null || shift $#
+aws=$(realpath ./aws)
+port=8888
+base="http://localhost:$port"
+
+work=$(mktemp -d)
+trap 'kill $pid $bulk_pids 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+head -c 2048 /dev/urandom > "$work/static/small.dat"
+head -c $((256 * 1024 * 1024)) /dev/zero > "$work/static/bulk.dat"
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+for i in $(seq 1 "$bulk"); do
+	while curl -s --http1.0 -o /dev/null "$base/static/bulk.dat"; do :; done &
+	bulk_pids="$bulk_pids $!"
+done
+sleep 1
+
+for i in $(seq 1 "$requests"); do
+	printf 'url = "%s"\noutput = "/dev/null"\n' "$base/static/small.dat"
+done > small
+curl -s --no-progress-meter --http1.0 -K small -w '%{time_total}\n' > times
+
+kill $bulk_pids 2>/dev/null
+wait $bulk_pids 2>/dev/null
+kill -USR1 $pid
+sleep 0.2
+
+sort -g times | awk '
+	{ t[n++] = $1 * 1e6 }
+	END {
+		printf "small: n=%d usec p50 %.0f p99 %.0f max %.0f\n",
+			n, t[int(n * 0.5)], t[int(n * 0.99)], t[n - 1];
+	}'
+grep -a "^inline: n=\|^sendfile: n=\|^send_sched\|^shaper" aws.err
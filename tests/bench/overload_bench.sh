@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Latency of admitted requests when more clients arrive than the server
+# admits.
+#
+# Run from the top directory after `make`:
+#	tests/bench/overload_bench.sh [clients] [requests] [server options]
+#
+# `clients` parallel connections fetch a small static/ file while a
+# quarter as many bulk downloads of a large dynamic/ file keep the server
+# busy. Pass admission limits such as --max-connections=64, or --codel,
+# and compare with a run without them: client side times include the
+# wait in the accept queue, the server's own histograms start at the
+# request.
+
+clients=${1:-256}
+requests=${2:-4096}
+shift 2 2>/dev/null || shift $#
+aws=$(realpath ./aws)
+port=8888
+base="http://localhost:$port"
+
+work=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+head -c 2048 /dev/urandom > "$work/static/small.dat"
+head -c $((16 * 1024 * 1024)) /dev/urandom > "$work/dynamic/bulk.dat"
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+urls()
+{
+	for i in $(seq 1 "$2"); do
+		printf 'url = "%s"\noutput = "/dev/null"\n' "$1"
+	done
+}
+
+urls "$base/dynamic/bulk.dat" $((clients / 4)) > bulk
+curl -s --no-progress-meter --http1.0 -Z --parallel-max "$clients" \
+	-K bulk -m 60 &
+bulk=$!
+
+urls "$base/static/small.dat" "$requests" > small
+curl -s --no-progress-meter --http1.0 -Z --parallel-max "$clients" \
+	-K small -m 30 \
+	-w '%{http_code} %{time_total}\n' > times
+wait $bulk
+
+kill -USR1 $pid
+sleep 0.2
+
+# admitted (200) requests by latency; 503 and failed transfers counted
+sort -k2 -g times | awk '
+	$1 == 200 { t[n++] = $2 * 1e6 }
+	$1 == 503 { rejected++ }
+	$1 == 000 { failed++ }
+	END {
+		printf "admitted %d rejected %d failed %d\n", n, rejected, failed;
+		if (n > 0)
+			printf "usec p50 %.0f p99 %.0f max %.0f\n",
+				t[int(n * 0.5)], t[int(n * 0.99)], t[n - 1];
+	}'
+grep -a "^inline\|^admission\|^codel\|^sojourn" aws.err
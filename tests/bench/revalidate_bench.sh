@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Bytes and latency per request when clients revalidate a cached asset.
+#
+# Run from the top directory after `make`:
+#	tests/bench/revalidate_bench.sh [requests] [size] [server options]
+#
+# One `size` byte static/ file is fetched `requests` times by one curl
+# process: first unconditionally, then with the If-None-Match and
+# If-Modified-Since a browser sends once it holds the file.
+
+requests=${1:-500}
+size=${2:-65536}
+shift 2 2>/dev/null || shift $#
+aws=$(realpath ./aws)
+port=8888
+url="http://localhost:$port/static/asset.dat"
+
+work=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir -p "$work/static" "$work/dynamic"
+head -c "$size" /dev/urandom > "$work/static/asset.dat"
+
+cd "$work" || exit 1
+"$aws" "$@" > /dev/null 2> aws.err &
+pid=$!
+sleep 0.5
+
+# one curl, `requests` transfers: bytes received and seconds per transfer
+run()
+{
+	for i in $(seq 1 "$requests"); do
+		printf 'url = "%s"\noutput = "/dev/null"\n' "$url"
+	done > urls
+	curl -s --http1.0 "$@" -K urls \
+		-w '%{size_header} %{size_download} %{time_total} %{http_code}\n'
+}
+
+report()
+{
+	awk -v name="$1" '
+	{ bytes += $1 + $2; usec += $3 * 1e6; n++; code = $4 }
+	END {
+		printf "%-14s %4s %12.0f %12.1f\n", name, code,
+			bytes / n, usec / n;
+	}'
+}
+
+curl -s --http1.0 -D headers -o /dev/null "$url"
+etag=$(awk 'tolower($1) == "etag:" { print $2 }' headers | tr -d '\r')
+modified=$(awk -F': ' 'tolower($1) == "last-modified" { print $2 }' headers | tr -d '\r')
+
+printf "%-14s %4s %12s %12s\n" "request" "code" "bytes/req" "usec/req"
+run | report "unconditional"
+run -H "If-None-Match: $etag" -H "If-Modified-Since: $modified" | \
+	report "revalidation"
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 first_test=1
-last_test=35
+last_test=59
 script=run_test.sh
 log_file=test.log
 
@@ -22,7 +22,7 @@ BEGIN {
 }
 
 END {
-    printf "\n%66s  [%02d/90]\n", "Total:", sum;
+    printf "\n%66s  [%02d/138]\n", "Total:", sum;
 }'
 
 # Cleanup testing environment